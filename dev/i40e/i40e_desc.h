@@ -0,0 +1,266 @@
+#ifndef _I40E_DESC_H__
+#define _I40E_DESC_H__
+
+/*
+ * Descriptor handling is kept inline so that ring routines
+ * instantiated from lib_burst.h can compile it into their loops.
+ */
+
+/* See 8.3.3 - Packet types, outer L3 only */
+static inline unsigned int i40e_ptype(unsigned int ptype)
+{
+	if(ptype == 11)
+		return UFP_PTYPE_ARP;
+	if(ptype >= 22 && ptype <= 87)
+		return UFP_PTYPE_IPV4;
+	if(ptype >= 88 && ptype <= 153)
+		return UFP_PTYPE_IPV6;
+
+	return UFP_PTYPE_UNKNOWN;
+}
+
+/* Offload results other than length, EOF and error */
+static inline void i40e_rx_desc_meta(struct i40e_rx_desc_wb *rx_desc_wb,
+	uint64_t qword1, struct ufp_packet *packet)
+{
+	packet->ptype = i40e_ptype((qword1 & I40E_RXD_QW1_PTYPE_MASK)
+		>> I40E_RXD_QW1_PTYPE_SHIFT);
+
+	if(((qword1 >> I40E_RX_DESC_STATUS_FLTSTAT_SHIFT)
+	& I40E_RX_DESC_FLTSTAT_MASK) == I40E_RX_DESC_FLTSTAT_RSS_HASH){
+		packet->hash = le32toh(rx_desc_wb->qword0.hi_dword.rss);
+		packet->flag |= UFP_PACKET_HASH;
+	}
+
+	if(qword1 & BIT(I40E_RX_DESC_STATUS_L3L4P_SHIFT)){
+		packet->flag |= UFP_PACKET_CSUM;
+
+		qword1 >>= I40E_RXD_QW1_ERROR_SHIFT;
+		if(qword1 & (BIT(I40E_RX_DESC_ERROR_IPE_SHIFT)
+		| BIT(I40E_RX_DESC_ERROR_EIPE_SHIFT)))
+			packet->flag |= UFP_PACKET_CSUM_L3_BAD;
+		if(qword1 & BIT(I40E_RX_DESC_ERROR_L4E_SHIFT))
+			packet->flag |= UFP_PACKET_CSUM_L4_BAD;
+	}
+
+	return;
+}
+
+static inline int i40e_rx_desc_fetch(struct ufp_ring *rx_ring,
+	uint16_t index, struct ufp_packet *packet)
+{
+	struct i40e_rx_desc *rx_desc;
+	struct i40e_rx_desc_wb *rx_desc_wb;
+	uint64_t qword1;
+
+	rx_desc = I40E_RX_DESC(rx_ring, index);
+	rx_desc_wb = (struct i40e_rx_desc_wb *)rx_desc;
+
+	qword1 = le64toh(rx_desc_wb->qword1.status_error_len);
+
+	if (!(qword1 & BIT(I40E_RX_DESC_STATUS_DD_SHIFT)))
+		goto not_received;
+
+	/*
+	 * This memory barrier is needed to keep us from reading
+	 * any other fields out of the rx_desc until we know the
+	 * RXD_STAT_DD bit is set
+	 */
+	rmb();
+
+	packet->slot_size = (qword1 & I40E_RXD_QW1_LENGTH_PBUF_MASK) >>
+		I40E_RXD_QW1_LENGTH_PBUF_SHIFT;
+	packet->flag = 0;
+
+	if(likely(qword1 & BIT(I40E_RX_DESC_STATUS_EOF_SHIFT)))
+		packet->flag |= UFP_PACKET_EOF;
+
+	if(unlikely(qword1 & I40E_RXD_QW1_ERROR_FRAME_MASK))
+		packet->flag |= UFP_PACKET_ERROR;
+
+	i40e_rx_desc_meta(rx_desc_wb, qword1, packet);
+	return 0;
+
+not_received:
+	return -1;
+}
+
+/*
+ * Descriptors are not written back in head write-back mode.
+ * Head is updated when a descriptor with RS is done.
+ */
+static inline unsigned int i40e_tx_desc_fetch_burst(
+	struct ufp_ring *tx_ring, uint16_t index, unsigned int num)
+{
+	uint32_t head;
+
+	head = le32toh(*tx_ring->head_wb);
+
+	/* Head behind index has wrapped, done up to the end of ring */
+	if(head >= index && head - index < num)
+		return head - index;
+
+	return num;
+}
+
+static inline int i40e_tx_desc_fetch(struct ufp_ring *tx_ring, uint16_t index)
+{
+	if(!i40e_tx_desc_fetch_burst(tx_ring, index, 1))
+		goto not_sent;
+
+	return 0;
+
+not_sent:
+	return -1;
+}
+
+static inline void i40e_rx_desc_fill(struct ufp_ring *rx_ring,
+	uint16_t index, uint64_t addr_dma)
+{
+	struct i40e_rx_desc *rx_desc;
+	struct i40e_rx_desc_wb *rx_desc_wb;
+
+	rx_desc = I40E_RX_DESC(rx_ring, index);
+	rx_desc_wb = (struct i40e_rx_desc_wb *)rx_desc;
+
+	rx_desc->pkt_addr = htole64(addr_dma);
+	rx_desc->hdr_addr = 0;
+
+	/* clear the status bits for the next_to_use descriptor */
+	rx_desc_wb->qword1.status_error_len = 0;
+
+	return;
+}
+
+static inline void i40e_tx_desc_offload(struct ufp_packet *packet,
+	uint32_t *tx_cmd, uint32_t *tx_offset)
+{
+	unsigned int flag;
+
+	flag = packet->flag;
+
+	*tx_offset |= (packet->l2_len >> 1)
+		<< I40E_TX_DESC_LENGTH_MACLEN_SHIFT;
+	*tx_offset |= (packet->l3_len >> 2)
+		<< I40E_TX_DESC_LENGTH_IPLEN_SHIFT;
+
+	/* IPv4 header checksum is also required per segment of TSO */
+	if(flag & UFP_PACKET_TX_IPV4){
+		if(flag & (UFP_PACKET_TX_IP_CSUM | UFP_PACKET_TX_TSO))
+			*tx_cmd |= I40E_TX_DESC_CMD_IIPT_IPV4_CSUM;
+		else
+			*tx_cmd |= I40E_TX_DESC_CMD_IIPT_IPV4;
+	}else if(flag & UFP_PACKET_TX_IPV6){
+		*tx_cmd |= I40E_TX_DESC_CMD_IIPT_IPV6;
+	}
+
+	if(flag & (UFP_PACKET_TX_TCP_CSUM | UFP_PACKET_TX_TSO)){
+		*tx_cmd |= I40E_TX_DESC_CMD_L4T_EOFT_TCP;
+		*tx_offset |= (packet->l4_len >> 2)
+			<< I40E_TX_DESC_LENGTH_L4_FC_LEN_SHIFT;
+	}else if(flag & UFP_PACKET_TX_UDP_CSUM){
+		*tx_cmd |= I40E_TX_DESC_CMD_L4T_EOFT_UDP;
+		*tx_offset |= (packet->l4_len >> 2)
+			<< I40E_TX_DESC_LENGTH_L4_FC_LEN_SHIFT;
+	}
+
+	return;
+}
+
+static inline int i40e_tx_ctx_desc_fill(struct ufp_ring *tx_ring,
+	uint16_t index, struct ufp_packet *packet)
+{
+	struct i40e_tx_context_desc *ctx_desc;
+	uint64_t tso_len;
+
+	/* Only TSO requires a context descriptor */
+	if(likely(!(packet->flag & UFP_PACKET_TX_TSO)))
+		return 0;
+
+	ctx_desc = I40E_TX_CTXTDESC(tx_ring, index);
+	tso_len = packet->slot_size
+		- (packet->l2_len + packet->l3_len + packet->l4_len);
+
+	ctx_desc->tunneling_params = 0;
+	ctx_desc->l2tag2 = 0;
+	ctx_desc->rsvd = 0;
+	ctx_desc->type_cmd_tso_mss = htole64(I40E_TX_DESC_DTYPE_CONTEXT |
+		((uint64_t)I40E_TX_CTX_DESC_TSO << I40E_TXD_CTX_QW1_CMD_SHIFT) |
+		(tso_len << I40E_TXD_CTX_QW1_TSO_LEN_SHIFT) |
+		((uint64_t)packet->mss << I40E_TXD_CTX_QW1_MSS_SHIFT));
+
+	return 1;
+}
+
+static inline void i40e_tx_desc_fill(struct ufp_ring *tx_ring,
+	uint16_t index, uint64_t addr_dma, struct ufp_packet *packet)
+{
+	struct i40e_tx_desc *tx_desc;
+	uint32_t tx_cmd = 0;
+	uint32_t tx_offset = 0;
+	uint32_t tx_tag = 0;
+
+	tx_desc = I40E_TX_DESC(tx_ring, index);
+
+	tx_cmd |= I40E_TX_DESC_CMD_ICRC;
+	if(likely(packet->flag & UFP_PACKET_EOF)){
+		tx_cmd |= I40E_TX_DESC_CMD_EOP;
+	}
+
+	if(unlikely(packet->flag & UFP_PACKET_TX_OFFLOAD))
+		i40e_tx_desc_offload(packet, &tx_cmd, &tx_offset);
+
+	/* XXX: The size limit for a transmit buffer in a descriptor is (16K - 1).
+	 * In order to align with the read requests we will align the value to
+	 * the nearest 4K which represents our maximum read request size.
+	 */
+	tx_desc->buffer_addr = htole64(addr_dma);
+	tx_desc->cmd_type_offset_bsz = htole64(I40E_TX_DESC_DTYPE_DATA |
+		((uint64_t)tx_cmd << I40E_TXD_QW1_CMD_SHIFT) |
+		((uint64_t)tx_offset << I40E_TXD_QW1_OFFSET_SHIFT) |
+		((uint64_t)packet->slot_size << I40E_TXD_QW1_TX_BUF_SZ_SHIFT) |
+		((uint64_t)tx_tag << I40E_TXD_QW1_L2TAG1_SHIFT));
+
+	return;
+}
+
+/* RS is decided after the batch is filled, see tx_assign */
+static inline void i40e_tx_desc_rs(struct ufp_ring *tx_ring,
+	uint16_t index)
+{
+	struct i40e_tx_desc *tx_desc;
+
+	tx_desc = I40E_TX_DESC(tx_ring, index);
+	tx_desc->cmd_type_offset_bsz |= htole64(
+		(uint64_t)I40E_TX_DESC_CMD_RS << I40E_TXD_QW1_CMD_SHIFT);
+
+	return;
+}
+
+static inline unsigned int i40e_rx_desc_fetch_burst(
+	struct ufp_ring *rx_ring, uint16_t index, struct ufp_packet *packet,
+	unsigned int num)
+{
+	unsigned int total;
+
+	for(total = 0; total < num; total++, index++){
+		if(i40e_rx_desc_fetch(rx_ring, index, &packet[total]) < 0)
+			break;
+	}
+
+	return total;
+}
+
+static inline void i40e_rx_desc_fill_burst(struct ufp_ring *rx_ring,
+	uint16_t index, uint64_t *addr_dma, unsigned int num)
+{
+	unsigned int i;
+
+	for(i = 0; i < num; i++){
+		i40e_rx_desc_fill(rx_ring, index + i, addr_dma[i]);
+	}
+
+	return;
+}
+
+#endif /* _I40E_DESC_H__ */
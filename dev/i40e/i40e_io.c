@@ -315,8 +315,15 @@ int i40e_vsi_configure_tx(struct ufp_dev *dev, struct ufp_iface *iface)
 		 * transmit descriptor WB:
 		 * 0b - Descriptor Write Back
 		 * 1b - Head Write Back
+		 * Head WB lets TX cleaning read one word
+		 * instead of each descriptor.
 		 */
-		ctx.head_wb_en = 0;
+		ring->head_wb = (uint32_t *)I40E_TX_DESC(ring,
+			iface->num_tx_desc);
+		*ring->head_wb = 0;
+		ctx.head_wb_en = 1;
+		ctx.headwb_addr = ring->addr_dma
+			+ iface->num_tx_desc * sizeof(struct i40e_tx_desc);
 
 		/*
 		 * See 1.1.4 - Transmit scheduler
@@ -868,107 +875,3 @@ static void i40e_pre_tx_queue_disable(struct ufp_dev *dev, uint32_t qp_idx)
 
 	return;
 }
-
-
-int i40e_rx_desc_fetch(struct ufp_ring *rx_ring, uint16_t index,
-	struct ufp_packet *packet)
-{
-	struct i40e_rx_desc *rx_desc;
-	struct i40e_rx_desc_wb *rx_desc_wb;
-	uint64_t qword1;
-
-	rx_desc = I40E_RX_DESC(rx_ring, index);
-	rx_desc_wb = (struct i40e_rx_desc_wb *)rx_desc;
-
-	qword1 = le64toh(rx_desc_wb->qword1.status_error_len);
-
-	if (!(qword1 & BIT(I40E_RX_DESC_STATUS_DD_SHIFT)))
-		goto not_received;
-
-	/*
-	 * This memory barrier is needed to keep us from reading
-	 * any other fields out of the rx_desc until we know the
-	 * RXD_STAT_DD bit is set
-	 */
-	rmb();
-
-	packet->slot_size = (qword1 & I40E_RXD_QW1_LENGTH_PBUF_MASK) >>
-		I40E_RXD_QW1_LENGTH_PBUF_SHIFT;
-	packet->flag = 0;
-
-	if(likely(qword1 & BIT(I40E_RX_DESC_STATUS_EOF_SHIFT)))
-		packet->flag |= UFP_PACKET_EOF;
-
-	if(unlikely(qword1 & I40E_RXD_QW1_ERROR_MASK))
-		packet->flag |= UFP_PACKET_ERROR;
-
-	return 0;
-
-not_received:
-	return -1;
-}
-
-int i40e_tx_desc_fetch(struct ufp_ring *tx_ring, uint16_t index)
-{
-	struct i40e_tx_desc *tx_desc;
-	uint64_t qword1;
-
-	tx_desc = I40E_TX_DESC(tx_ring, index);
-	qword1 = le64toh(tx_desc->cmd_type_offset_bsz);
-
-	if ((qword1 & I40E_TXD_QW1_DTYPE_MASK) !=
-		I40E_TX_DESC_DTYPE_DESC_DONE)
-		goto not_sent;
-
-	return 0;
-
-not_sent:
-	return -1;
-}
-
-void i40e_rx_desc_fill(struct ufp_ring *rx_ring, uint16_t index,
-	uint64_t addr_dma)
-{
-	struct i40e_rx_desc *rx_desc;
-	struct i40e_rx_desc_wb *rx_desc_wb;
-
-	rx_desc = I40E_RX_DESC(rx_ring, index);
-	rx_desc_wb = (struct i40e_rx_desc_wb *)rx_desc;
-
-	rx_desc->pkt_addr = htole64(addr_dma);
-	rx_desc->hdr_addr = 0;
-
-	/* clear the status bits for the next_to_use descriptor */
-	rx_desc_wb->qword1.status_error_len = 0;
-
-	return;
-}
-
-void i40e_tx_desc_fill(struct ufp_ring *tx_ring, uint16_t index,
-	uint64_t addr_dma, struct ufp_packet *packet)
-{
-	struct i40e_tx_desc *tx_desc;
-	uint32_t tx_cmd = 0;
-	uint32_t tx_offset = 0;
-	uint32_t tx_tag = 0;
-
-	tx_desc = I40E_TX_DESC(tx_ring, index);
-
-	tx_cmd |= I40E_TX_DESC_CMD_ICRC | I40E_TX_DESC_CMD_RS;
-	if(likely(packet->flag & UFP_PACKET_EOF)){
-		tx_cmd |= I40E_TX_DESC_CMD_EOP;
-	}
-
-	/* XXX: The size limit for a transmit buffer in a descriptor is (16K - 1).
-	 * In order to align with the read requests we will align the value to
-	 * the nearest 4K which represents our maximum read request size.
-	 */
-	tx_desc->buffer_addr = htole64(addr_dma);
-	tx_desc->cmd_type_offset_bsz = htole64(I40E_TX_DESC_DTYPE_DATA |
-		((uint64_t)tx_cmd << I40E_TXD_QW1_CMD_SHIFT) |
-		((uint64_t)tx_offset << I40E_TXD_QW1_OFFSET_SHIFT) |
-		((uint64_t)packet->slot_size << I40E_TXD_QW1_TX_BUF_SZ_SHIFT) |
-		((uint64_t)tx_tag << I40E_TXD_QW1_L2TAG1_SHIFT));
-
-	return;
-}
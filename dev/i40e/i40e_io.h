@@ -116,9 +116,34 @@ enum i40e_rx_desc_status_bits {
 	I40E_RX_DESC_STATUS_LAST /* this entry must be last!!! */
 };
 
+#define I40E_RX_DESC_FLTSTAT_MASK	0x3
+#define I40E_RX_DESC_FLTSTAT_RSS_HASH	0x3
+
+enum i40e_rx_desc_error_bits {
+	/* Note: These are predefined bit offsets */
+	I40E_RX_DESC_ERROR_RXE_SHIFT		= 0,
+	I40E_RX_DESC_ERROR_RECIPE_SHIFT		= 1,
+	I40E_RX_DESC_ERROR_HBO_SHIFT		= 2,
+	I40E_RX_DESC_ERROR_IPE_SHIFT		= 3,
+	I40E_RX_DESC_ERROR_L4E_SHIFT		= 4,
+	I40E_RX_DESC_ERROR_EIPE_SHIFT		= 5,
+	I40E_RX_DESC_ERROR_OVERSIZE_SHIFT	= 6,
+	I40E_RX_DESC_ERROR_PPRS_SHIFT		= 7
+};
+
 #define I40E_RXD_QW1_ERROR_SHIFT 19
 #define I40E_RXD_QW1_ERROR_MASK \
 	(0xFFUL << I40E_RXD_QW1_ERROR_SHIFT)
+/* Checksum errors are reported apart from frame errors */
+#define I40E_RXD_QW1_ERROR_CSUM_MASK \
+	((BIT(I40E_RX_DESC_ERROR_IPE_SHIFT) | \
+	BIT(I40E_RX_DESC_ERROR_L4E_SHIFT) | \
+	BIT(I40E_RX_DESC_ERROR_EIPE_SHIFT)) << I40E_RXD_QW1_ERROR_SHIFT)
+#define I40E_RXD_QW1_ERROR_FRAME_MASK \
+	(I40E_RXD_QW1_ERROR_MASK & ~I40E_RXD_QW1_ERROR_CSUM_MASK)
+#define I40E_RXD_QW1_PTYPE_SHIFT 30
+#define I40E_RXD_QW1_PTYPE_MASK \
+	(0xFFULL << I40E_RXD_QW1_PTYPE_SHIFT)
 #define I40E_RXD_QW1_LENGTH_PBUF_SHIFT 38
 #define I40E_RXD_QW1_LENGTH_PBUF_MASK \
 	(0x3FFFULL << I40E_RXD_QW1_LENGTH_PBUF_SHIFT)
@@ -166,6 +191,13 @@ enum i40e_tx_desc_cmd_bits {
 	I40E_TX_DESC_CMD_L4T_EOFT_EOF_A		= 0x0300, /* 2 BITS */
 };
 
+enum i40e_tx_desc_length_fields {
+	/* Note: These are predefined bit offsets */
+	I40E_TX_DESC_LENGTH_MACLEN_SHIFT	= 0, /* 7 BITS */
+	I40E_TX_DESC_LENGTH_IPLEN_SHIFT		= 7, /* 7 BITS */
+	I40E_TX_DESC_LENGTH_L4_FC_LEN_SHIFT	= 14 /* 4 BITS */
+};
+
 #define I40E_TXD_QW1_DTYPE_SHIFT 0
 #define I40E_TXD_QW1_DTYPE_MASK \
 	(0xFUL << I40E_TXD_QW1_DTYPE_SHIFT)
@@ -182,10 +214,44 @@ enum i40e_tx_desc_cmd_bits {
 #define I40E_TXD_QW1_L2TAG1_MASK \
 	(0xFFFFULL << I40E_TXD_QW1_L2TAG1_SHIFT)
 
+/*
+ * See 8.4.2.2 - Transmit Context Descriptor
+ */
+struct i40e_tx_context_desc {
+	uint32_t tunneling_params;
+	uint16_t l2tag2;
+	uint16_t rsvd;
+	uint64_t type_cmd_tso_mss;
+};
+
+enum i40e_tx_ctx_desc_cmd_bits {
+	I40E_TX_CTX_DESC_TSO			= 0x01,
+	I40E_TX_CTX_DESC_TSYN			= 0x02,
+	I40E_TX_CTX_DESC_IL2TAG2		= 0x04,
+	I40E_TX_CTX_DESC_IL2TAG2_IL2H		= 0x08,
+	I40E_TX_CTX_DESC_SWTCH_NOTAG		= 0x00,
+	I40E_TX_CTX_DESC_SWTCH_UPLINK		= 0x10,
+	I40E_TX_CTX_DESC_SWTCH_LOCAL		= 0x20,
+	I40E_TX_CTX_DESC_SWTCH_VSI		= 0x30,
+	I40E_TX_CTX_DESC_SWPE			= 0x40
+};
+
+#define I40E_TXD_CTX_QW1_CMD_SHIFT 4
+#define I40E_TXD_CTX_QW1_CMD_MASK \
+	(0xFFFFUL << I40E_TXD_CTX_QW1_CMD_SHIFT)
+#define I40E_TXD_CTX_QW1_TSO_LEN_SHIFT 30
+#define I40E_TXD_CTX_QW1_TSO_LEN_MASK \
+	(0x3FFFFULL << I40E_TXD_CTX_QW1_TSO_LEN_SHIFT)
+#define I40E_TXD_CTX_QW1_MSS_SHIFT 50
+#define I40E_TXD_CTX_QW1_MSS_MASK \
+	(0x3FFFULL << I40E_TXD_CTX_QW1_MSS_SHIFT)
+
 #define I40E_RX_DESC(R, i)                      \
 	(&(((struct i40e_rx_desc *)((R)->addr_virt))[i]))
 #define I40E_TX_DESC(R, i)                      \
 	(&(((struct i40e_tx_desc *)((R)->addr_virt))[i]))
+#define I40E_TX_CTXTDESC(R, i)                  \
+	(&(((struct i40e_tx_context_desc *)((R)->addr_virt))[i]))
 
 int i40e_vsi_update(struct ufp_dev *dev, struct ufp_iface *iface);
 int i40e_vsi_get(struct ufp_dev *dev, struct ufp_iface *iface);
@@ -202,12 +268,5 @@ int i40e_vsi_start_rx(struct ufp_dev *dev, struct ufp_iface *iface);
 int i40e_vsi_stop_rx(struct ufp_dev *dev, struct ufp_iface *iface);
 int i40e_vsi_start_tx(struct ufp_dev *dev, struct ufp_iface *iface);
 int i40e_vsi_stop_tx(struct ufp_dev *dev, struct ufp_iface *iface);
-int i40e_rx_desc_fetch(struct ufp_ring *rx_ring, uint16_t index,
-	struct ufp_packet *packet);
-int i40e_tx_desc_fetch(struct ufp_ring *tx_ring, uint16_t index);
-void i40e_rx_desc_fill(struct ufp_ring *rx_ring, uint16_t index,
-	uint64_t addr_dma);
-void i40e_tx_desc_fill(struct ufp_ring *tx_ring, uint16_t index,
-	uint64_t addr_dma, struct ufp_packet *packet);
 
 #endif /* _I40E_IO_H__ */
@@ -925,8 +925,10 @@ static int i40e_setup_pf_switch(struct ufp_dev *dev)
 	iface->size_rx_desc	=
 		iface->num_rx_desc * sizeof(struct i40e_rx_desc);
 	iface->num_tx_desc	= I40E_MAX_NUM_DESCRIPTORS;
+	/* Head write-back follows the descriptors */
 	iface->size_tx_desc	=
-		iface->num_tx_desc * sizeof(struct i40e_tx_desc);
+		iface->num_tx_desc * sizeof(struct i40e_tx_desc)
+		+ sizeof(uint32_t);
 	return 0;
 
 err_alloc_iface:
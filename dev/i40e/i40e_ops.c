@@ -8,10 +8,13 @@
 
 #include <lib_main.h>
 #include <lib_dev.h>
+#include <lib_io.h>
 
 #include "i40e_main.h"
 #include "i40e_io.h"
+#include "i40e_desc.h"
 #include "i40e_ops.h"
+#include "i40e_vec.h"
 
 static int i40e_ops_init(struct ufp_dev *dev, struct ufp_ops *ops);
 static void i40e_ops_destroy(struct ufp_dev *dev, struct ufp_ops *ops);
@@ -73,6 +76,11 @@ static int i40e_ops_init(struct ufp_dev *dev, struct ufp_ops *ops)
 	ops->fetch_rx_desc	= i40e_rx_desc_fetch;
 	ops->fill_tx_desc	= i40e_tx_desc_fill;
 	ops->fetch_tx_desc	= i40e_tx_desc_fetch;
+	ops->fill_tx_ctx_desc	= i40e_tx_ctx_desc_fill;
+	ops->set_tx_desc_rs	= i40e_tx_desc_rs;
+
+	/* Burst and ring functions, vectorized one is chosen by cpuid */
+	i40e_vec_ops_init(ops);
 
 	return 0;
 
@@ -0,0 +1,324 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <lib_main.h>
+#include <lib_io.h>
+
+#include "i40e_main.h"
+#include "i40e_io.h"
+#include "i40e_desc.h"
+#include "i40e_vec.h"
+
+/* Scalar ring routines */
+#define UFP_BURST(name) i40e_##name
+#define UFP_BURST_FETCH_RX(port, ring, index, packet, num) \
+	i40e_rx_desc_fetch_burst(ring, index, packet, num)
+#define UFP_BURST_FETCH_TX(port, ring, index, num) \
+	i40e_tx_desc_fetch_burst(ring, index, num)
+#define UFP_BURST_FILL_RX(port, ring, index, addr_dma, num) \
+	i40e_rx_desc_fill_burst(ring, index, addr_dma, num)
+#define UFP_BURST_FILL_TX(port, ring, index, addr_dma, packet) \
+	i40e_tx_desc_fill(ring, index, addr_dma, packet)
+#define UFP_BURST_FILL_TX_CTX(port, ring, index, packet) \
+	i40e_tx_ctx_desc_fill(ring, index, packet)
+#define UFP_BURST_SET_TX_RS(port, ring, index) \
+	i40e_tx_desc_rs(ring, index)
+#include <lib_burst.h>
+#undef UFP_BURST
+#undef UFP_BURST_FETCH_RX
+#undef UFP_BURST_FILL_RX
+
+#if defined(__x86_64__)
+static unsigned int i40e_rx_desc_fetch_burst_sse(struct ufp_ring *rx_ring,
+	uint16_t index, struct ufp_packet *packet, unsigned int num);
+static void i40e_rx_desc_fill_burst_sse(struct ufp_ring *rx_ring,
+	uint16_t index, uint64_t *addr_dma, unsigned int num);
+static unsigned int i40e_rx_desc_fetch_burst_avx2(struct ufp_ring *rx_ring,
+	uint16_t index, struct ufp_packet *packet, unsigned int num)
+	__attribute__ ((target("avx2")));
+static void i40e_rx_desc_fill_burst_avx2(struct ufp_ring *rx_ring,
+	uint16_t index, uint64_t *addr_dma, unsigned int num)
+	__attribute__ ((target("avx2")));
+
+/*
+ * Descriptors are loaded from the last one to the first one.
+ * NIC writes back in order, so when DD of a later descriptor is seen,
+ * the earlier ones loaded after it are also complete.
+ */
+static unsigned int i40e_rx_desc_fetch_burst_sse(struct ufp_ring *rx_ring,
+	uint16_t index, struct ufp_packet *packet, unsigned int num)
+{
+	__m128i desc[4], stat, hi, len, flag;
+	uint32_t len_a[4], flag_a[4], stat_a[4], hi_a[4];
+	unsigned int total, done, i;
+	int dd;
+
+	total = 0;
+	while(num - total >= 4){
+		desc[3] = _mm_loadu_si128(
+			(__m128i *)I40E_RX_DESC(rx_ring, index + 3));
+		asm volatile("" ::: "memory");
+		desc[2] = _mm_loadu_si128(
+			(__m128i *)I40E_RX_DESC(rx_ring, index + 2));
+		asm volatile("" ::: "memory");
+		desc[1] = _mm_loadu_si128(
+			(__m128i *)I40E_RX_DESC(rx_ring, index + 1));
+		asm volatile("" ::: "memory");
+		desc[0] = _mm_loadu_si128(
+			(__m128i *)I40E_RX_DESC(rx_ring, index));
+
+		/* Gather status (low) and length (high) dwords of qword1 */
+		stat = _mm_castps_si128(_mm_shuffle_ps(
+			_mm_castsi128_ps(_mm_unpackhi_epi64(desc[0], desc[1])),
+			_mm_castsi128_ps(_mm_unpackhi_epi64(desc[2], desc[3])),
+			_MM_SHUFFLE(2, 0, 2, 0)));
+		hi = _mm_castps_si128(_mm_shuffle_ps(
+			_mm_castsi128_ps(_mm_unpackhi_epi64(desc[0], desc[1])),
+			_mm_castsi128_ps(_mm_unpackhi_epi64(desc[2], desc[3])),
+			_MM_SHUFFLE(3, 1, 3, 1)));
+
+		dd = _mm_movemask_ps(_mm_castsi128_ps(_mm_slli_epi32(stat,
+			31 - I40E_RX_DESC_STATUS_DD_SHIFT)));
+		done = __builtin_ctz(~dd);
+		if(!done)
+			break;
+
+		rmb();
+
+		len = _mm_and_si128(_mm_srli_epi32(hi,
+			I40E_RXD_QW1_LENGTH_PBUF_SHIFT - 32),
+			_mm_set1_epi32(0x3FFF));
+		flag = _mm_or_si128(
+			_mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(stat,
+				_mm_set1_epi32(BIT(I40E_RX_DESC_STATUS_EOF_SHIFT))),
+				_mm_set1_epi32(BIT(I40E_RX_DESC_STATUS_EOF_SHIFT))),
+				_mm_set1_epi32(UFP_PACKET_EOF)),
+			_mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(stat,
+				_mm_set1_epi32(I40E_RXD_QW1_ERROR_FRAME_MASK)),
+				_mm_setzero_si128()),
+				_mm_set1_epi32(UFP_PACKET_ERROR)));
+
+		_mm_storeu_si128((__m128i *)len_a, len);
+		_mm_storeu_si128((__m128i *)flag_a, flag);
+		_mm_storeu_si128((__m128i *)stat_a, stat);
+		_mm_storeu_si128((__m128i *)hi_a, hi);
+
+		for(i = 0; i < done; i++){
+			packet[total + i].slot_size = len_a[i];
+			packet[total + i].flag = flag_a[i];
+			i40e_rx_desc_meta((struct i40e_rx_desc_wb *)
+				I40E_RX_DESC(rx_ring, index + i),
+				((uint64_t)hi_a[i] << 32) | stat_a[i],
+				&packet[total + i]);
+		}
+
+		total += done;
+		index += done;
+		if(done < 4)
+			return total;
+	}
+
+	/* Remainder */
+	for(; total < num; total++, index++){
+		if(i40e_rx_desc_fetch(rx_ring, index, &packet[total]) < 0)
+			break;
+	}
+
+	return total;
+}
+
+static void i40e_rx_desc_fill_burst_sse(struct ufp_ring *rx_ring,
+	uint16_t index, uint64_t *addr_dma, unsigned int num)
+{
+	unsigned int i;
+
+	/* hdr_addr shares qword1 with status, one store clears both */
+	for(i = 0; i < num; i++){
+		_mm_storeu_si128((__m128i *)I40E_RX_DESC(rx_ring, index + i),
+			_mm_set_epi64x(0, addr_dma[i]));
+	}
+
+	return;
+}
+
+static unsigned int i40e_rx_desc_fetch_burst_avx2(struct ufp_ring *rx_ring,
+	uint16_t index, struct ufp_packet *packet, unsigned int num)
+{
+	__m256i desc[4], half[2], stat, hi, len, flag;
+	uint32_t len_a[8], flag_a[8], stat_a[8], hi_a[8];
+	unsigned int total, done, i;
+	int dd;
+
+	total = 0;
+	while(num - total >= 8){
+		/* Each load holds two descriptors */
+		desc[3] = _mm256_loadu_si256(
+			(__m256i *)I40E_RX_DESC(rx_ring, index + 6));
+		asm volatile("" ::: "memory");
+		desc[2] = _mm256_loadu_si256(
+			(__m256i *)I40E_RX_DESC(rx_ring, index + 4));
+		asm volatile("" ::: "memory");
+		desc[1] = _mm256_loadu_si256(
+			(__m256i *)I40E_RX_DESC(rx_ring, index + 2));
+		asm volatile("" ::: "memory");
+		desc[0] = _mm256_loadu_si256(
+			(__m256i *)I40E_RX_DESC(rx_ring, index));
+
+		/* Lane 0 holds even descriptors, lane 1 holds odd ones */
+		half[0] = _mm256_castps_si256(_mm256_shuffle_ps(
+			_mm256_castsi256_ps(desc[0]),
+			_mm256_castsi256_ps(desc[1]), _MM_SHUFFLE(3, 2, 3, 2)));
+		half[1] = _mm256_castps_si256(_mm256_shuffle_ps(
+			_mm256_castsi256_ps(desc[2]),
+			_mm256_castsi256_ps(desc[3]), _MM_SHUFFLE(3, 2, 3, 2)));
+		stat = _mm256_castps_si256(_mm256_shuffle_ps(
+			_mm256_castsi256_ps(half[0]),
+			_mm256_castsi256_ps(half[1]), _MM_SHUFFLE(2, 0, 2, 0)));
+		hi = _mm256_castps_si256(_mm256_shuffle_ps(
+			_mm256_castsi256_ps(half[0]),
+			_mm256_castsi256_ps(half[1]), _MM_SHUFFLE(3, 1, 3, 1)));
+
+		/* Back to descriptor order */
+		stat = _mm256_permutevar8x32_epi32(stat,
+			_mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+		hi = _mm256_permutevar8x32_epi32(hi,
+			_mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+
+		dd = _mm256_movemask_ps(_mm256_castsi256_ps(
+			_mm256_slli_epi32(stat,
+			31 - I40E_RX_DESC_STATUS_DD_SHIFT)));
+		done = __builtin_ctz(~dd);
+		if(!done)
+			break;
+
+		rmb();
+
+		len = _mm256_and_si256(_mm256_srli_epi32(hi,
+			I40E_RXD_QW1_LENGTH_PBUF_SHIFT - 32),
+			_mm256_set1_epi32(0x3FFF));
+		flag = _mm256_or_si256(
+			_mm256_and_si256(_mm256_cmpeq_epi32(_mm256_and_si256(stat,
+				_mm256_set1_epi32(BIT(I40E_RX_DESC_STATUS_EOF_SHIFT))),
+				_mm256_set1_epi32(BIT(I40E_RX_DESC_STATUS_EOF_SHIFT))),
+				_mm256_set1_epi32(UFP_PACKET_EOF)),
+			_mm256_andnot_si256(_mm256_cmpeq_epi32(
+				_mm256_and_si256(stat,
+				_mm256_set1_epi32(
+				I40E_RXD_QW1_ERROR_FRAME_MASK)),
+				_mm256_setzero_si256()),
+				_mm256_set1_epi32(UFP_PACKET_ERROR)));
+
+		_mm256_storeu_si256((__m256i *)len_a, len);
+		_mm256_storeu_si256((__m256i *)flag_a, flag);
+		_mm256_storeu_si256((__m256i *)stat_a, stat);
+		_mm256_storeu_si256((__m256i *)hi_a, hi);
+
+		for(i = 0; i < done; i++){
+			packet[total + i].slot_size = len_a[i];
+			packet[total + i].flag = flag_a[i];
+			i40e_rx_desc_meta((struct i40e_rx_desc_wb *)
+				I40E_RX_DESC(rx_ring, index + i),
+				((uint64_t)hi_a[i] << 32) | stat_a[i],
+				&packet[total + i]);
+		}
+
+		total += done;
+		index += done;
+		if(done < 8)
+			return total;
+	}
+
+	return total + i40e_rx_desc_fetch_burst_sse(rx_ring, index,
+		&packet[total], num - total);
+}
+
+static void i40e_rx_desc_fill_burst_avx2(struct ufp_ring *rx_ring,
+	uint16_t index, uint64_t *addr_dma, unsigned int num)
+{
+	unsigned int i;
+
+	/* Two descriptors per store */
+	for(i = 0; i + 2 <= num; i += 2){
+		_mm256_storeu_si256((__m256i *)I40E_RX_DESC(rx_ring, index + i),
+			_mm256_set_epi64x(0, addr_dma[i + 1], 0, addr_dma[i]));
+	}
+
+	if(i < num){
+		_mm_storeu_si128((__m128i *)I40E_RX_DESC(rx_ring, index + i),
+			_mm_set_epi64x(0, addr_dma[i]));
+	}
+
+	return;
+}
+
+/* SSE ring routines */
+#define UFP_BURST(name) i40e_sse_##name
+#define UFP_BURST_FETCH_RX(port, ring, index, packet, num) \
+	i40e_rx_desc_fetch_burst_sse(ring, index, packet, num)
+#define UFP_BURST_FILL_RX(port, ring, index, addr_dma, num) \
+	i40e_rx_desc_fill_burst_sse(ring, index, addr_dma, num)
+#include <lib_burst.h>
+#undef UFP_BURST
+#undef UFP_BURST_FETCH_RX
+#undef UFP_BURST_FILL_RX
+
+/* AVX2 ring routines, whole loops are compiled for AVX2 to inline */
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define UFP_BURST(name) i40e_avx2_##name
+#define UFP_BURST_FETCH_RX(port, ring, index, packet, num) \
+	i40e_rx_desc_fetch_burst_avx2(ring, index, packet, num)
+#define UFP_BURST_FILL_RX(port, ring, index, addr_dma, num) \
+	i40e_rx_desc_fill_burst_avx2(ring, index, addr_dma, num)
+#include <lib_burst.h>
+#undef UFP_BURST
+#undef UFP_BURST_FETCH_RX
+#undef UFP_BURST_FILL_RX
+#pragma GCC pop_options
+#endif
+#undef UFP_BURST_FETCH_TX
+#undef UFP_BURST_FILL_TX
+#undef UFP_BURST_FILL_TX_CTX
+#undef UFP_BURST_SET_TX_RS
+
+void i40e_vec_ops_init(struct ufp_ops *ops)
+{
+	/* Scalar path is the fallback */
+	ops->fetch_rx_desc_burst	= i40e_rx_desc_fetch_burst;
+	ops->fetch_tx_desc_burst	= i40e_tx_desc_fetch_burst;
+	ops->fill_rx_desc_burst		= i40e_rx_desc_fill_burst;
+	ops->rx_clean			= i40e_rx_clean;
+	ops->rx_assign			= i40e_rx_assign;
+	ops->tx_assign			= i40e_tx_assign;
+	ops->tx_clean			= i40e_tx_clean;
+
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+
+	if(__builtin_cpu_supports("avx2")){
+		ops->fetch_rx_desc_burst = i40e_rx_desc_fetch_burst_avx2;
+		ops->fill_rx_desc_burst	= i40e_rx_desc_fill_burst_avx2;
+		ops->rx_clean		= i40e_avx2_rx_clean;
+		ops->rx_assign		= i40e_avx2_rx_assign;
+		ops->tx_assign		= i40e_avx2_tx_assign;
+		ops->tx_clean		= i40e_avx2_tx_clean;
+	}else if(__builtin_cpu_supports("sse2")){
+		ops->fetch_rx_desc_burst = i40e_rx_desc_fetch_burst_sse;
+		ops->fill_rx_desc_burst	= i40e_rx_desc_fill_burst_sse;
+		ops->rx_clean		= i40e_sse_rx_clean;
+		ops->rx_assign		= i40e_sse_rx_assign;
+		ops->tx_assign		= i40e_sse_tx_assign;
+		ops->tx_clean		= i40e_sse_tx_clean;
+	}
+#endif
+
+	return;
+}
@@ -0,0 +1,6 @@
+#ifndef _I40E_VEC_H__
+#define _I40E_VEC_H__
+
+void i40e_vec_ops_init(struct ufp_ops *ops);
+
+#endif /* _I40E_VEC_H__ */
@@ -4,6 +4,7 @@
 #include <ufp_list.h>
 
 struct ufp_mpool;
+struct ufp_mcache;
 struct ufp_dev;
 struct ufp_iface;
 struct ufp_irq;
@@ -15,10 +16,48 @@ struct ufp_packet {
 	unsigned int		slot_size;
 	int			slot_index;
 	unsigned int		flag;
+	uint32_t		hash; /* RSS, valid with UFP_PACKET_HASH */
+	unsigned int		ptype; /* UFP_PTYPE_* of RX */
+	uint16_t		l2_len; /* header lengths for TX offload */
+	uint16_t		l3_len;
+	uint16_t		l4_len;
+	uint16_t		mss; /* valid with UFP_PACKET_TX_TSO */
 };
 
+/*
+ * TX offload: l2_len and l3_len are required with any UFP_PACKET_TX_*,
+ * and l4_len with TCP/UDP checksum and TSO. L4 checksum field must be
+ * seeded with the pseudo header sum, excluding the length for TSO.
+ */
+
 #define UFP_PACKET_ERROR	0x00000001
 #define UFP_PACKET_EOF		0x00000002
+#define UFP_PACKET_HASH		0x00000004
+#define UFP_PACKET_CSUM		0x00000008 /* L3/L4 checksum checked */
+#define UFP_PACKET_CSUM_L3_BAD	0x00000010
+#define UFP_PACKET_CSUM_L4_BAD	0x00000020
+#define UFP_PACKET_TX_IPV4	0x00000100
+#define UFP_PACKET_TX_IPV6	0x00000200
+#define UFP_PACKET_TX_IP_CSUM	0x00000400
+#define UFP_PACKET_TX_TCP_CSUM	0x00000800
+#define UFP_PACKET_TX_UDP_CSUM	0x00001000
+#define UFP_PACKET_TX_TSO	0x00002000
+#define UFP_PACKET_TX_OFFLOAD	0x00003f00
+
+/* Outer L3 type parsed by NIC, regardless of VLAN tags */
+#define UFP_PTYPE_UNKNOWN	0
+#define UFP_PTYPE_ARP		1
+#define UFP_PTYPE_IPV4		2
+#define UFP_PTYPE_IPV6		3
+
+#define UFP_MEM_MAX_ORDER	40
+
+struct ufp_mem_stats {
+	unsigned long		size;
+	unsigned long		free;
+	unsigned long		free_order[UFP_MEM_MAX_ORDER + 1]; /* bytes */
+	unsigned int		fragmentation; /* percent */
+};
 
 enum ufp_irq_type {
 	UFP_IRQ_RX = 0,
@@ -29,10 +68,10 @@ enum ufp_irq_type {
 struct ufp_plane *ufp_plane_alloc(struct ufp_dev **devs, int num_devs,
 	struct ufp_buf *buf, unsigned int thread_id, unsigned int core_id);
 void ufp_plane_release(struct ufp_plane *plane);
-struct ufp_mpool *ufp_mpool_init();
+struct ufp_mpool *ufp_mpool_init(size_t size, int node);
 void ufp_mpool_destroy(struct ufp_mpool *mpool);
 struct ufp_buf *ufp_alloc_buf(struct ufp_dev **devs, int num_devs,
-	uint32_t slot_size, uint32_t buf_count, struct ufp_mpool *mpool);
+	uint32_t slot_size, uint32_t buf_count, struct ufp_mpool **mpools);
 void ufp_release_buf(struct ufp_buf *buf);
 struct ufp_dev *ufp_open(const char *name);
 void ufp_close(struct ufp_dev *dev);
@@ -47,6 +86,11 @@ void *ufp_mem_alloc(struct ufp_mpool *mpool, size_t size);
 void *ufp_mem_alloc_align(struct ufp_mpool *mpool, size_t size,
 	size_t align);
 void ufp_mem_free(void *addr_free);
+void ufp_mem_stats(struct ufp_mpool *mpool, struct ufp_mem_stats *stats);
+struct ufp_mcache *ufp_mcache_alloc(struct ufp_mpool *mpool, size_t size);
+void ufp_mcache_release(struct ufp_mcache *cache);
+void *ufp_mcache_get(struct ufp_mcache *cache);
+void ufp_mcache_put(struct ufp_mcache *cache, void *obj);
 
 /* IO */
 void ufp_irq_unmask_queues(struct ufp_plane *plane,
@@ -55,18 +99,28 @@ void ufp_rx_assign(struct ufp_plane *plane, unsigned int port_idx,
 	struct ufp_buf *buf);
 void ufp_tx_assign(struct ufp_plane *plane, unsigned int port_idx,
 	struct ufp_buf *buf, struct ufp_packet *packet);
+unsigned int ufp_tx_assign_bulk(struct ufp_plane *plane,
+	unsigned int port_idx, struct ufp_buf *buf,
+	struct ufp_packet **packet, unsigned int num);
 void ufp_tx_xmit(struct ufp_plane *plane, unsigned int port_idx);
 unsigned int ufp_rx_clean(struct ufp_plane *plane, unsigned int port_idx,
 	struct ufp_buf *buf, struct ufp_packet *packet);
 void ufp_tx_clean(struct ufp_plane *plane, unsigned int port_idx,
 	struct ufp_buf *buf);
-inline int ufp_slot_assign(struct ufp_buf *buf,
+int ufp_slot_assign(struct ufp_buf *buf,
 	struct ufp_plane *plane, unsigned int port_idx);
-inline void ufp_slot_release(struct ufp_buf *buf,
+unsigned int ufp_slot_assign_bulk(struct ufp_buf *buf,
+	struct ufp_plane *plane, unsigned int port_idx,
+	int *slot_index, unsigned int num);
+void ufp_slot_release(struct ufp_buf *buf,
+	int slot_index);
+void ufp_slot_release_bulk(struct ufp_buf *buf,
+	int *slot_index, unsigned int num);
+void *ufp_slot_addr_virt(struct ufp_buf *buf,
 	int slot_index);
-inline void *ufp_slot_addr_virt(struct ufp_buf *buf,
-	uint16_t slot_index);
 inline unsigned int ufp_slot_size(struct ufp_buf *buf);
+void ufp_packet_clone(struct ufp_buf *buf, struct ufp_packet *packet,
+	struct ufp_packet *clone);
 
 /* API */
 void *ufp_macaddr(struct ufp_plane *plane,
@@ -74,6 +128,7 @@ void *ufp_macaddr(struct ufp_plane *plane,
 unsigned short ufp_portnum(struct ufp_plane *plane);
 unsigned int ufp_framemtu(struct ufp_plane *plane,
 	unsigned int port_idx);
+/* Frames on tun fd are prefixed by struct virtio_net_hdr */
 int ufp_tun_fd(struct ufp_plane *plane,
 	unsigned int port_idx);
 int ufp_tun_index(struct ufp_plane *plane,
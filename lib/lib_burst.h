@@ -0,0 +1,306 @@
+/*
+ * Ring level RX/TX routines, instantiated once per descriptor format.
+ * No include guard, the includer defines before each inclusion:
+ *
+ *   UFP_BURST(name)
+ *	name of instantiated functions
+ *   UFP_BURST_FETCH_RX(port, ring, index, packet, num)
+ *   UFP_BURST_FETCH_TX(port, ring, index, num)
+ *	number of completed descriptors from index, without wrapping
+ *   UFP_BURST_FILL_RX(port, ring, index, addr_dma, num)
+ *	fill num RX descriptors from index, without wrapping
+ *   UFP_BURST_FILL_TX(port, ring, index, addr_dma, packet)
+ *	fill one TX descriptor
+ *   UFP_BURST_FILL_TX_CTX(port, ring, index, packet)
+ *	fill one TX context descriptor if packet needs it for TSO,
+ *	and return 1 when filled, otherwise 0
+ *   UFP_BURST_SET_TX_RS(port, ring, index)
+ *	request status report of a filled TX data descriptor
+ *
+ * When they expand to static inline functions visible to the includer,
+ * descriptor handling is compiled into the ring loops.
+ * lib_main.h and lib_io.h must be included first.
+ */
+
+void UFP_BURST(rx_assign)(struct ufp_plane *plane,
+	unsigned int port_idx, struct ufp_buf *buf);
+void UFP_BURST(tx_clean)(struct ufp_plane *plane,
+	unsigned int port_idx, struct ufp_buf *buf);
+
+unsigned int UFP_BURST(rx_clean)(struct ufp_plane *plane,
+	unsigned int port_idx, struct ufp_buf *buf, struct ufp_packet *packet)
+{
+	struct ufp_port *port;
+	struct ufp_ring *rx_ring;
+	struct ufp_buf_region *region;
+	unsigned int total_rx_packets, num_request, num_fetched, i;
+
+	port = &plane->ports[port_idx];
+	rx_ring = port->rx_ring;
+	region = ufp_port_region(buf, port_idx);
+
+	total_rx_packets = 0;
+	while(likely(total_rx_packets < port->rx_budget)){
+		uint16_t next_to_clean;
+		int slot_index;
+
+		next_to_clean = rx_ring->next_to_clean;
+		if(unlikely(next_to_clean == rx_ring->next_to_use)){
+			break;
+		}
+
+		/* Up to next_to_use, or the end of ring */
+		num_request = (rx_ring->next_to_use > next_to_clean) ?
+			rx_ring->next_to_use - next_to_clean :
+			port->num_rx_desc - next_to_clean;
+		if(num_request > port->rx_budget - total_rx_packets)
+			num_request = port->rx_budget - total_rx_packets;
+
+		num_fetched = UFP_BURST_FETCH_RX(port, rx_ring,
+			next_to_clean, &packet[total_rx_packets], num_request);
+
+		for(i = 0; i < num_fetched; i++){
+			ufp_print("Rx: packet received size = %d\n",
+				packet[total_rx_packets + i].slot_size);
+
+			/* retrieve a buffer address from the ring */
+			slot_index = ufp_slot_detach(rx_ring, next_to_clean + i);
+			packet[total_rx_packets + i].slot_index = slot_index;
+			packet[total_rx_packets + i].slot_buf =
+				ufp_slot_virt(buf, region, slot_index);
+		}
+
+		next_to_clean += num_fetched;
+		rx_ring->next_to_clean =
+			(next_to_clean < port->num_rx_desc) ? next_to_clean : 0;
+
+		total_rx_packets += num_fetched;
+		if(num_fetched < num_request)
+			break;
+	}
+
+	/*
+	 * Refill in the same burst, so that RX does not wait for
+	 * the caller. Slots released by TX completion are on top of
+	 * the free stack of the device, and they are still cache hot.
+	 */
+	if(total_rx_packets)
+		UFP_BURST(rx_assign)(plane, port_idx, buf);
+
+	port->count_rx_clean_total += total_rx_packets;
+	return total_rx_packets;
+}
+
+void UFP_BURST(rx_assign)(struct ufp_plane *plane,
+	unsigned int port_idx, struct ufp_buf *buf)
+{
+	struct ufp_port *port;
+	struct ufp_ring *rx_ring;
+	struct ufp_buf_region *region;
+	unsigned int total_allocated, num_request, num_assigned;
+	unsigned int num_fill, i, j;
+	uint16_t max_allocation;
+	int slot_index[UFP_SLOT_BULK];
+	uint64_t addr_dma[UFP_SLOT_BULK];
+
+	port = &plane->ports[port_idx];
+	rx_ring = port->rx_ring;
+	region = ufp_port_region(buf, port_idx);
+
+	max_allocation = ufp_desc_unused(rx_ring, port->num_rx_desc);
+	if (!max_allocation)
+		return;
+
+	total_allocated = 0;
+	while(likely(total_allocated < max_allocation)){
+		num_request = max_allocation - total_allocated;
+		if(num_request > UFP_SLOT_BULK)
+			num_request = UFP_SLOT_BULK;
+
+		num_assigned = ufp_slot_get_bulk(buf, port_idx,
+			slot_index, num_request);
+
+		for(i = 0; i < num_assigned; i++){
+			addr_dma[i] = (uint64_t)ufp_slot_addr_dma(buf,
+				region, slot_index[i]);
+		}
+
+		/* Burst must not wrap around the ring */
+		for(i = 0; i < num_assigned; i += num_fill){
+			uint16_t next_to_use;
+
+			num_fill = port->num_rx_desc - rx_ring->next_to_use;
+			if(num_fill > num_assigned - i)
+				num_fill = num_assigned - i;
+
+			UFP_BURST_FILL_RX(port, rx_ring,
+				rx_ring->next_to_use, &addr_dma[i], num_fill);
+			for(j = 0; j < num_fill; j++){
+				ufp_slot_attach(rx_ring,
+					rx_ring->next_to_use + j,
+					slot_index[i + j]);
+			}
+
+			next_to_use = rx_ring->next_to_use + num_fill;
+			rx_ring->next_to_use =
+				(next_to_use < port->num_rx_desc) ?
+				next_to_use : 0;
+		}
+
+		total_allocated += num_assigned;
+
+		if(unlikely(num_assigned < num_request)){
+			port->count_rx_alloc_failed +=
+				(max_allocation - total_allocated);
+			break;
+		}
+	}
+
+	if(likely(total_allocated)){
+		/*
+		 * Force memory writes to complete before letting h/w
+		 * know there are new descriptors to fetch.  (Only
+		 * applicable for weak-ordered memory model archs,
+		 * such as IA-64).
+		 */
+		/* XXX: Do we need this write memory barrier ? */
+		wmb();
+		ufp_write_tail(rx_ring, rx_ring->next_to_use);
+	}
+}
+
+unsigned int UFP_BURST(tx_assign)(struct ufp_plane *plane,
+	unsigned int port_idx, struct ufp_buf *buf,
+	struct ufp_packet **packet, unsigned int num)
+{
+	struct ufp_port *port;
+	struct ufp_ring *tx_ring;
+	unsigned int num_assign, num_unused, num_rs_pending, i;
+	uint16_t next_to_use, last_to_use;
+	uint64_t addr_dma;
+
+	port = &plane->ports[port_idx];
+	tx_ring = port->tx_ring;
+
+	/* Reap completions inline rather than waiting for TX IRQ */
+	num_unused = ufp_desc_unused(tx_ring, port->num_tx_desc);
+	if(unlikely(num_unused < UFP_TX_CLEAN_WATERMARK
+	|| num_unused < num)){
+		UFP_BURST(tx_clean)(plane, port_idx, buf);
+		num_unused = ufp_desc_unused(tx_ring, port->num_tx_desc);
+	}
+
+	next_to_use = tx_ring->next_to_use;
+	last_to_use = next_to_use;
+	num_rs_pending = 0;
+	for(i = 0; i < num; i++){
+		/* TSO packet takes a context descriptor ahead of data */
+		if(unlikely(num_unused < ((packet[i]->flag
+		& UFP_PACKET_TX_TSO) ? 2 : 1)))
+			break;
+
+		if(unlikely(UFP_BURST_FILL_TX_CTX(port, tx_ring,
+		next_to_use, packet[i]))){
+			ufp_slot_attach(tx_ring, next_to_use, -1);
+			num_unused--;
+			num_rs_pending++;
+
+			next_to_use++;
+			if(unlikely(next_to_use == port->num_tx_desc))
+				next_to_use = 0;
+		}
+
+		/* Forwarded slot may belong to another device */
+		addr_dma = (uint64_t)ufp_slot_addr_dma(buf,
+			ufp_slot_region(buf, packet[i]->slot_index),
+			packet[i]->slot_index);
+		UFP_BURST_FILL_TX(port, tx_ring, next_to_use,
+			addr_dma, packet[i]);
+		ufp_slot_attach(tx_ring, next_to_use, packet[i]->slot_index);
+		ufp_print("Tx: packet sending DMAaddr = %p size = %d\n",
+			(void *)addr_dma, packet[i]->slot_size);
+		num_unused--;
+		num_rs_pending++;
+
+		/* Context descriptor can not carry RS */
+		if(unlikely(num_rs_pending >= UFP_TX_RS_THRESH)){
+			UFP_BURST_SET_TX_RS(port, tx_ring, next_to_use);
+			num_rs_pending = 0;
+		}
+		last_to_use = next_to_use;
+
+		next_to_use++;
+		if(unlikely(next_to_use == port->num_tx_desc))
+			next_to_use = 0;
+	}
+	tx_ring->next_to_use = next_to_use;
+	num_assign = i;
+
+	/* Every descriptor before the tail must end up reported */
+	if(num_rs_pending)
+		UFP_BURST_SET_TX_RS(port, tx_ring, last_to_use);
+
+	if(unlikely(num_assign < num)){
+		port->count_tx_xmit_failed += num - num_assign;
+		for(i = num_assign; i < num; i++){
+			ufp_slot_put(buf, packet[i]->slot_index);
+		}
+	}
+
+	port->tx_suspended += num_assign;
+	return num_assign;
+}
+
+void UFP_BURST(tx_clean)(struct ufp_plane *plane,
+	unsigned int port_idx, struct ufp_buf *buf)
+{
+	struct ufp_port *port;
+	struct ufp_ring *tx_ring;
+	unsigned int total_tx_packets, num_request, num_fetched, num_put, i;
+	int slot_index[UFP_SLOT_BULK];
+
+	port = &plane->ports[port_idx];
+	tx_ring = port->tx_ring;
+
+	total_tx_packets = 0;
+	while(likely(total_tx_packets < port->tx_budget)){
+		uint16_t next_to_clean;
+
+		next_to_clean = tx_ring->next_to_clean;
+		if(unlikely(next_to_clean == tx_ring->next_to_use)){
+			break;
+		}
+
+		num_request = (tx_ring->next_to_use > next_to_clean) ?
+			tx_ring->next_to_use - next_to_clean :
+			port->num_tx_desc - next_to_clean;
+		if(num_request > port->tx_budget - total_tx_packets)
+			num_request = port->tx_budget - total_tx_packets;
+		if(num_request > UFP_SLOT_BULK)
+			num_request = UFP_SLOT_BULK;
+
+		num_fetched = UFP_BURST_FETCH_TX(port, tx_ring,
+			next_to_clean, num_request);
+
+		/* Release unused buffer, context descriptor has no slot */
+		num_put = 0;
+		for(i = 0; i < num_fetched; i++){
+			slot_index[num_put] = ufp_slot_detach(tx_ring,
+				next_to_clean + i);
+			if(likely(slot_index[num_put] >= 0))
+				num_put++;
+		}
+		ufp_slot_put_bulk(buf, slot_index, num_put);
+
+		next_to_clean += num_fetched;
+		tx_ring->next_to_clean =
+			(next_to_clean < port->num_tx_desc) ? next_to_clean : 0;
+
+		total_tx_packets += num_fetched;
+		if(num_fetched < num_request)
+			break;
+	}
+
+	port->count_tx_clean_total += total_tx_packets;
+	return;
+}
@@ -17,4 +17,115 @@
 #define wmb() asm volatile("" ::: "memory")
 #endif
 
+static inline uint16_t ufp_desc_unused(struct ufp_ring *ring,
+	uint16_t num_desc)
+{
+	uint16_t next_to_clean = ring->next_to_clean;
+	uint16_t next_to_use = ring->next_to_use;
+
+	return next_to_clean > next_to_use
+		? next_to_clean - next_to_use - 1
+		: (num_desc - next_to_use) + next_to_clean - 1;
+}
+
+static inline void ufp_write_tail(struct ufp_ring *ring, uint32_t value)
+{
+	ufp_writel(value, ring->tail);
+	return;
+}
+
+static inline void ufp_slot_attach(struct ufp_ring *ring,
+	uint16_t desc_index, int slot_index)
+{
+	ring->slot_index[desc_index] = slot_index;
+	return;
+}
+
+static inline int ufp_slot_detach(struct ufp_ring *ring,
+	uint16_t desc_index)
+{
+	return ring->slot_index[desc_index];
+}
+
+static inline struct ufp_buf_region *ufp_port_region(struct ufp_buf *buf,
+	unsigned int port_idx)
+{
+	return &buf->regions[buf->port_region[port_idx]];
+}
+
+static inline struct ufp_buf_region *ufp_slot_region(struct ufp_buf *buf,
+	int slot_index)
+{
+	return &buf->regions[slot_index / buf->region_slots];
+}
+
+/* region must own the slot, see ufp_slot_region() */
+static inline void *ufp_slot_virt(struct ufp_buf *buf,
+	struct ufp_buf_region *region, int slot_index)
+{
+	return (void *)(region->base_virt
+		+ (unsigned long)buf->slot_size * slot_index);
+}
+
+static inline unsigned long ufp_slot_addr_dma(struct ufp_buf *buf,
+	struct ufp_buf_region *region, int slot_index)
+{
+	return region->base_dma
+		+ (unsigned long)buf->slot_size * slot_index;
+}
+
+static inline unsigned int ufp_slot_get_bulk(struct ufp_buf *buf,
+	unsigned int port_idx, int *slot_index, unsigned int num)
+{
+	struct ufp_slot_stack *stack;
+	unsigned int i;
+
+	stack = &ufp_port_region(buf, port_idx)->free;
+	if(unlikely(num > stack->top))
+		num = stack->top;
+
+	for(i = 0; i < num; i++){
+		slot_index[i] = stack->index[--stack->top];
+		buf->refcnt[slot_index[i]] = 1;
+	}
+
+	return num;
+}
+
+static inline void ufp_slot_put(struct ufp_buf *buf, int slot_index)
+{
+	struct ufp_slot_stack *stack;
+
+	/* Clones still in flight */
+	if(--buf->refcnt[slot_index])
+		return;
+
+	/* Slot goes back to the device which owns it */
+	stack = &ufp_slot_region(buf, slot_index)->free;
+	stack->index[stack->top++] = slot_index;
+	return;
+}
+
+static inline void ufp_slot_put_bulk(struct ufp_buf *buf,
+	int *slot_index, unsigned int num)
+{
+	unsigned int i;
+
+	for(i = 0; i < num; i++){
+		ufp_slot_put(buf, slot_index[i]);
+	}
+
+	return;
+}
+
+unsigned int ufp_generic_rx_clean(struct ufp_plane *plane,
+	unsigned int port_idx, struct ufp_buf *buf, struct ufp_packet *packet);
+void ufp_generic_rx_assign(struct ufp_plane *plane,
+	unsigned int port_idx, struct ufp_buf *buf);
+unsigned int ufp_generic_tx_assign(struct ufp_plane *plane,
+	unsigned int port_idx, struct ufp_buf *buf,
+	struct ufp_packet **packet, unsigned int num);
+void ufp_generic_tx_clean(struct ufp_plane *plane,
+	unsigned int port_idx, struct ufp_buf *buf);
+
 #endif /* _LIBUFP_RTX_H */
@@ -11,16 +11,29 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #include <signal.h>
 #include <pthread.h>
 
 #include "lib_main.h"
+#include "lib_io.h"
 #include "lib_list.h"
 #include "lib_dev.h"
 #include "lib_mem.h"
 #include "lib_tap.h"
 #include "lib_vfio.h"
 
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+static void *ufp_mpool_map(size_t *size, int node);
+static int ufp_mpool_addr_dma(struct ufp_mpool *mpool, void *addr_virt,
+	unsigned long *addr_dma);
 static int ufp_ifname_base(struct ufp_dev *dev, struct ufp_iface *iface);
 static int ufp_alloc_ring(struct ufp_dev *dev, struct ufp_ring *ring,
 	unsigned long size_desc, uint32_t num_desc, struct ufp_mpool *mpool);
@@ -131,6 +144,16 @@ struct ufp_plane *ufp_plane_alloc(struct ufp_dev **devs, int num_devs,
 			port->bar		= devs[i]->bar;
 			port->dev_idx		= i;
 
+			/* Prefer driver specialized ring routines */
+			port->rx_clean		= port->ops->rx_clean ?
+				port->ops->rx_clean : ufp_generic_rx_clean;
+			port->rx_assign		= port->ops->rx_assign ?
+				port->ops->rx_assign : ufp_generic_rx_assign;
+			port->tx_assign		= port->ops->tx_assign ?
+				port->ops->tx_assign : ufp_generic_tx_assign;
+			port->tx_clean		= port->ops->tx_clean ?
+				port->ops->tx_clean : ufp_generic_tx_clean;
+
 			port->rx_ring		= &(iface->rx_ring[thread_id]);
 			port->tx_ring		= &(iface->tx_ring[thread_id]);
 			port->rx_irq		= iface->rx_irq[thread_id];
@@ -145,8 +168,6 @@ struct ufp_plane *ufp_plane_alloc(struct ufp_dev **devs, int num_devs,
 			port->tap_fd		= iface->tap_fds[thread_id];
 			port->tap_index		= iface->tap_index;
 
-			port->rx_slot_next	= 0;
-			port->rx_slot_offset	= port_idx * buf->count;
 			port->tx_suspended	= 0;
 			port->count_rx_alloc_failed	= 0;
 			port->count_rx_clean_total	= 0;
@@ -185,36 +206,31 @@ void ufp_plane_release(struct ufp_plane *plane)
 	return;
 }
 
-struct ufp_mpool *ufp_mpool_init()
+/*
+ * Pool starts with "size" bytes of hugepages and grows by at least
+ * the same amount when exhausted. Pages are bound to "node"
+ * unless it is negative.
+ */
+struct ufp_mpool *ufp_mpool_init(size_t size, int node)
 {
 	struct ufp_mpool *mpool;
-	unsigned long size;
+	int err;
 
 	mpool = malloc(sizeof(struct ufp_mpool));
 	if(!mpool)
 		goto err_alloc_mpool;
 
-	size = SIZE_1GB;
-	mpool->addr_virt = mmap(NULL, size, PROT_READ | PROT_WRITE,
-#ifdef MAP_HUGE_1GB
-		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_1GB,
-#else
-		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
-#endif
-		-1, 0);
-	if(mpool->addr_virt == MAP_FAILED){
-		goto err_mmap;
-	}
+	mpool->size_grow = ALIGN(size, SIZE_2MB);
+	mpool->node = node;
+	ufp_mem_init(mpool);
 
-	mpool->node = ufp_mem_init(mpool->addr_virt, size);
-	if(!mpool->node)
-		goto err_mem_init;
+	err = ufp_mpool_grow(mpool, mpool->size_grow);
+	if(err < 0)
+		goto err_grow;
 
 	return mpool;
 
-err_mem_init:
-	munmap(mpool->addr_virt, SIZE_1GB);
-err_mmap:
+err_grow:
 	free(mpool);
 err_alloc_mpool:
 	return NULL;
@@ -222,13 +238,121 @@ err_alloc_mpool:
 
 void ufp_mpool_destroy(struct ufp_mpool *mpool)
 {
-	ufp_mem_destroy(mpool->node);
-	munmap(mpool->addr_virt, SIZE_1GB);
+	int i;
+
+	for(i = 0; i < mpool->num_chunks; i++){
+		if(mpool->chunks[i].dma_mapped)
+			ufp_vfio_dma_unmap(mpool->chunks[i].addr_dma,
+				mpool->chunks[i].size);
+		munmap(mpool->chunks[i].addr_virt, mpool->chunks[i].size);
+	}
 	free(mpool);
 
 	return;
 }
 
+int ufp_mpool_grow(struct ufp_mpool *mpool, size_t size)
+{
+	void *addr_virt;
+	int err;
+
+	if(mpool->num_chunks == UFP_MPOOL_MAX_CHUNKS)
+		goto err_chunks;
+
+	addr_virt = ufp_mpool_map(&size, mpool->node);
+	if(!addr_virt)
+		goto err_map;
+
+	err = ufp_mem_add(mpool, addr_virt, size);
+	if(err < 0)
+		goto err_mem_add;
+
+	return 0;
+
+err_mem_add:
+	munmap(addr_virt, size);
+err_map:
+err_chunks:
+	return -1;
+}
+
+static void *ufp_mpool_map(size_t *size, int node)
+{
+	void *addr_virt;
+	unsigned long node_mask;
+	int err;
+
+	/* 1GB pages if the size allows, otherwise 2MB pages */
+	if(!(*size & (SIZE_1GB - 1))){
+		addr_virt = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_1GB,
+			-1, 0);
+		if(addr_virt != MAP_FAILED)
+			goto bind;
+	}
+
+	*size = ALIGN(*size, SIZE_2MB);
+	addr_virt = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB,
+		-1, 0);
+	if(addr_virt == MAP_FAILED)
+		goto err_mmap;
+
+bind:
+	/* Pages are not faulted yet, they come from the node */
+	if(node >= 0){
+		node_mask = 1UL << node;
+		err = syscall(SYS_mbind, addr_virt, *size, MPOL_BIND,
+			&node_mask, sizeof(unsigned long) * 8, 0);
+		if(err < 0)
+			goto err_mbind;
+	}
+
+	return addr_virt;
+
+err_mbind:
+	munmap(addr_virt, *size);
+err_mmap:
+	return NULL;
+}
+
+/*
+ * Whole chunk is mapped at the first DMA use of it, since IOMMU of
+ * the container is not set up until a device is opened.
+ * Allocations in the chunk inherit the address by offset.
+ */
+static int ufp_mpool_addr_dma(struct ufp_mpool *mpool, void *addr_virt,
+	unsigned long *addr_dma)
+{
+	struct ufp_mchunk *chunk;
+	int err, i;
+
+	for(i = 0; i < mpool->num_chunks; i++){
+		chunk = &mpool->chunks[i];
+		if(addr_virt >= chunk->addr_virt
+		&& addr_virt < chunk->addr_virt + chunk->size)
+			goto found;
+	}
+	goto err_chunk;
+
+found:
+	if(!chunk->dma_mapped){
+		err = ufp_vfio_dma_map(chunk->addr_virt, &chunk->addr_dma,
+			chunk->size);
+		if(err < 0)
+			goto err_dma_map;
+
+		chunk->dma_mapped = 1;
+	}
+
+	*addr_dma = chunk->addr_dma + (addr_virt - chunk->addr_virt);
+	return 0;
+
+err_dma_map:
+err_chunk:
+	return -1;
+}
+
 static int ufp_alloc_rings(struct ufp_dev *dev, struct ufp_iface *iface,
 	struct ufp_mpool **mpools)
 {
@@ -311,7 +435,7 @@ static int ufp_alloc_ring(struct ufp_dev *dev, struct ufp_ring *ring,
 	if(!addr_virt)
 		goto err_alloc;
 
-	err = ufp_vfio_dma_map(addr_virt, &addr_dma, size_desc_align);
+	err = ufp_mpool_addr_dma(mpool, addr_virt, &addr_dma);
 	if(err < 0)
 		goto err_dma_map;
 
@@ -329,7 +453,6 @@ static int ufp_alloc_ring(struct ufp_dev *dev, struct ufp_ring *ring,
 	return 0;
 
 err_assign:
-	ufp_vfio_dma_unmap(ring->addr_dma, size_desc_align);
 err_dma_map:
 	ufp_mem_free(addr_virt);
 err_alloc:
@@ -339,21 +462,26 @@ err_alloc:
 static void ufp_release_ring(struct ufp_dev *dev, struct ufp_ring *ring,
 	unsigned long size_desc)
 {
-	size_t size_desc_align;
-
-	size_desc_align = ALIGN(size_desc, getpagesize());
 	free(ring->slot_index);
-	ufp_vfio_dma_unmap(ring->addr_dma, size_desc_align);
 	ufp_mem_free(ring->addr_virt);
 	return;
 }
 
+/*
+ * Slots of each device are allocated from mpools[dev_idx], so that
+ * they can be placed on the node of the device. Devices given the same
+ * mpool share one region of buf_count slots, regardless of their ports.
+ */
 struct ufp_buf *ufp_alloc_buf(struct ufp_dev **devs, int num_devs,
-	uint32_t slot_size, uint32_t buf_count, struct ufp_mpool *mpool)
+	uint32_t slot_size, uint32_t buf_count, struct ufp_mpool **mpools)
 {
 	struct ufp_buf *buf;
-	int err, i, num_bufs;
-	size_t size_buf_align;
+	struct ufp_buf_region *region;
+	struct ufp_mpool **region_mpools;
+	int err, i, j, k, port_idx, num_slots;
+	int regions_done = 0;
+	size_t size_region_align;
+	unsigned long offset;
 
 	buf = malloc(sizeof(struct ufp_buf));
 	if(!buf)
@@ -364,38 +492,100 @@ struct ufp_buf *ufp_alloc_buf(struct ufp_dev **devs, int num_devs,
 	 * DPDK does so in rte_mempool.c/optimize_object_size().
 	 */
 	buf->slot_size = slot_size;
-	buf->count = buf_count;
-	for(i = 0, num_bufs = 0; i < num_devs; i++){
-		num_bufs += devs[i]->num_ifaces * buf->count;
+	buf->num_ports = 0;
+	for(i = 0; i < num_devs; i++){
+		buf->num_ports += devs[i]->num_ifaces;
 	}
-	buf->size = buf->slot_size * num_bufs;
-	size_buf_align = ALIGN(buf->size, getpagesize());
 
-	buf->addr_virt = ufp_mem_alloc_align(mpool, size_buf_align,
-		getpagesize());
-	if(!buf->addr_virt)
-		goto err_mem_alloc;
+	region_mpools = malloc(sizeof(struct ufp_mpool *) * num_devs);
+	if(!region_mpools)
+		goto err_alloc_region_mpools;
 
-	err = ufp_vfio_dma_map(buf->addr_virt, &buf->addr_dma,
-		size_buf_align);
-	if(err < 0)
-		goto err_dma_map;
+	buf->port_region = malloc(sizeof(unsigned int) * buf->num_ports);
+	if(!buf->port_region)
+		goto err_alloc_port_region;
+
+	/* One region per distinct mpool */
+	buf->num_regions = 0;
+	for(i = 0, port_idx = 0; i < num_devs; i++){
+		for(j = 0; j < buf->num_regions; j++){
+			if(region_mpools[j] == mpools[i])
+				break;
+		}
+
+		if(j == buf->num_regions)
+			region_mpools[buf->num_regions++] = mpools[i];
+
+		for(k = 0; k < devs[i]->num_ifaces; k++, port_idx++){
+			buf->port_region[port_idx] = j;
+		}
+	}
 
-	buf->slots = malloc(sizeof(int) * num_bufs);
-	if(!buf->slots)
-		goto err_alloc_slots;
+	/* Same index range for each region, to find it by division */
+	buf->region_slots = buf_count;
+	num_slots = buf->region_slots * buf->num_regions;
+
+	buf->regions = malloc(sizeof(struct ufp_buf_region)
+		* buf->num_regions);
+	if(!buf->regions)
+		goto err_alloc_regions;
+
+	buf->refcnt = malloc(sizeof(uint16_t) * num_slots);
+	if(!buf->refcnt)
+		goto err_alloc_refcnt;
+
+	buf->free_index = malloc(sizeof(int32_t) * num_slots);
+	if(!buf->free_index)
+		goto err_alloc_free_index;
+
+	for(i = 0; i < buf->num_regions; i++, regions_done++){
+		region = &buf->regions[i];
+		region->size = (uint64_t)buf->slot_size * buf->region_slots;
+		size_region_align = ALIGN(region->size, getpagesize());
+
+		region->addr_virt = ufp_mem_alloc_align(region_mpools[i],
+			size_region_align, getpagesize());
+		if(!region->addr_virt)
+			goto err_mem_alloc;
+
+		err = ufp_mpool_addr_dma(region_mpools[i], region->addr_virt,
+			&region->addr_dma);
+		if(err < 0){
+			ufp_mem_free(region->addr_virt);
+			goto err_mem_alloc;
+		}
 
-	for(i = 0; i < num_bufs; i++){
-		buf->slots[i] = 0;
+		/* Biased, so that slot_index can be used as is */
+		offset = (unsigned long)buf->slot_size
+			* buf->region_slots * i;
+		region->base_virt = (unsigned long)region->addr_virt - offset;
+		region->base_dma = region->addr_dma - offset;
+
+		region->free.index = &buf->free_index[buf->region_slots * i];
+		region->free.top = buf->region_slots;
+		for(j = 0; j < buf->region_slots; j++){
+			region->free.index[j] = (buf->region_slots * i)
+				+ (buf->region_slots - j - 1);
+		}
 	}
 
+	free(region_mpools);
 	return buf;
 
-err_alloc_slots:
-	ufp_vfio_dma_unmap(buf->addr_dma, size_buf_align);
-err_dma_map:
-	ufp_mem_free(buf->addr_virt);
 err_mem_alloc:
+	for(i = 0; i < regions_done; i++){
+		ufp_mem_free(buf->regions[i].addr_virt);
+	}
+	free(buf->free_index);
+err_alloc_free_index:
+	free(buf->refcnt);
+err_alloc_refcnt:
+	free(buf->regions);
+err_alloc_regions:
+	free(buf->port_region);
+err_alloc_port_region:
+	free(region_mpools);
+err_alloc_region_mpools:
 	free(buf);
 err_alloc_buf:
 	return NULL;
@@ -403,17 +593,16 @@ err_alloc_buf:
 
 void ufp_release_buf(struct ufp_buf *buf)
 {
-	int err;
-	size_t size_buf_align;
-
-	free(buf->slots);
-	size_buf_align = ALIGN(buf->size, getpagesize());
+	int i;
 
-	err = ufp_vfio_dma_unmap(buf->addr_dma, size_buf_align);
-	if(err < 0)
-		perror("failed to unmap buf");
+	for(i = 0; i < buf->num_regions; i++){
+		ufp_mem_free(buf->regions[i].addr_virt);
+	}
 
-	ufp_mem_free(buf->addr_virt);
+	free(buf->free_index);
+	free(buf->refcnt);
+	free(buf->port_region);
+	free(buf->regions);
 	free(buf);
 	return;
 }
@@ -9,12 +9,16 @@
 #include <time.h>
 #include "lib_list.h"
 
+struct ufp_plane;
+struct ufp_packet;
+
 #define DRIVER_PATH		"/usr/local/lib/dev/"
 #define ALIGN(x,a)		__ALIGN_MASK(x,(typeof(x))(a)-1)
 #define __ALIGN_MASK(x,mask)	(((x)+(mask))&~(mask))
 
 #define FILENAME_SIZE 256
 #define SIZE_1GB (1ul << 30)
+#define SIZE_2MB (1ul << 21)
 
 #define min(x, y) ({				\
 	typeof(x) _min1 = (x);			\
@@ -59,9 +63,28 @@
 #define UFP_WRITE32(dev, reg, value) \
 	ufp_writel((value), (dev)->bar + (reg))
 
-struct ufp_mpool {
-	struct ufp_mnode	*node;
+#define UFP_MEM_MIN_ORDER	8 /* 256 bytes */
+#define UFP_MEM_MAX_ORDER	40
+#define UFP_MEM_FREE		0x80
+#define UFP_MPOOL_MAX_CHUNKS	64
+
+/* Hugepages mapped at once, grown pool has several of them */
+struct ufp_mchunk {
 	void			*addr_virt;
+	unsigned long		addr_dma;
+	int			dma_mapped;
+	size_t			size;
+	uint8_t			*order; /* per minimum block, in the chunk */
+};
+
+struct ufp_mpool {
+	struct ufp_mchunk	chunks[UFP_MPOOL_MAX_CHUNKS];
+	unsigned int		num_chunks;
+	size_t			size;
+	size_t			size_grow;
+	int			node;
+	struct list_head	free[UFP_MEM_MAX_ORDER + 1];
+	unsigned long		num_free[UFP_MEM_MAX_ORDER + 1];
 };
 
 struct ufp_ring {
@@ -69,20 +92,43 @@ struct ufp_ring {
 	unsigned long		addr_dma;
 
 	uint8_t			*tail;
+	volatile uint32_t	*head_wb; /* TX head written back by NIC */
 	uint16_t		next_to_use;
 	uint16_t		next_to_clean;
 	int32_t			*slot_index;
 };
 
-#define UFP_SLOT_INFLIGHT 0x1
+#define UFP_SLOT_BULK 64
+#define UFP_TX_CLEAN_WATERMARK 256 /* free TX descriptors */
+#define UFP_TX_RS_THRESH 32 /* TX descriptors per status report */
+
+/* LIFO of free slots, recently released (cache hot) one comes first */
+struct ufp_slot_stack {
+	int32_t			*index;
+	uint32_t		top;
+};
+
+/* Slots shared by ports on a device, allocated on the node of the device */
+struct ufp_buf_region {
+	/* Biased by the first slot of the region, slot index applies as is */
+	unsigned long		base_virt;
+	unsigned long		base_dma;
+	struct ufp_slot_stack	free;
 
-struct ufp_buf {
 	void			*addr_virt;
 	unsigned long		addr_dma;
-	uint32_t		slot_size;
 	uint64_t		size;
-	uint32_t		count;
-	int32_t			*slots;
+};
+
+struct ufp_buf {
+	struct ufp_buf_region	*regions; /* per mpool, i.e. NUMA node */
+	unsigned int		num_regions;
+	unsigned int		*port_region; /* per port */
+	uint32_t		slot_size;
+	uint32_t		region_slots; /* slots of a region */
+	uint32_t		num_ports;
+	uint16_t		*refcnt; /* per slot, 0 if free */
+	int32_t			*free_index;
 };
 
 struct ufp_iface {
@@ -144,6 +190,18 @@ struct ufp_port {
 	struct ufp_ops		*ops;
 	uint32_t		dev_idx;
 
+	/* Ring level routines, chosen once at ufp_plane_alloc() */
+	unsigned int		(*rx_clean)(struct ufp_plane *plane,
+				unsigned int port_idx, struct ufp_buf *buf,
+				struct ufp_packet *packet);
+	void			(*rx_assign)(struct ufp_plane *plane,
+				unsigned int port_idx, struct ufp_buf *buf);
+	unsigned int		(*tx_assign)(struct ufp_plane *plane,
+				unsigned int port_idx, struct ufp_buf *buf,
+				struct ufp_packet **packet, unsigned int num);
+	void			(*tx_clean)(struct ufp_plane *plane,
+				unsigned int port_idx, struct ufp_buf *buf);
+
 	/* struct iface specific parameters */
 	struct ufp_ring		*rx_ring;
 	struct ufp_ring		*tx_ring;
@@ -160,8 +218,6 @@ struct ufp_port {
 	int			tap_index;
 
 	/* original parameters */
-	uint32_t		rx_slot_next;
-	uint32_t		rx_slot_offset;
 	uint32_t		tx_suspended;
 	unsigned long		count_rx_alloc_failed;
 	unsigned long		count_rx_clean_total;
@@ -179,10 +235,33 @@ struct ufp_packet {
 	unsigned int		slot_size;
 	int			slot_index;
 	unsigned int		flag;
+	uint32_t		hash; /* RSS, valid with UFP_PACKET_HASH */
+	unsigned int		ptype; /* UFP_PTYPE_* of RX */
+	uint16_t		l2_len; /* header lengths for TX offload */
+	uint16_t		l3_len;
+	uint16_t		l4_len;
+	uint16_t		mss; /* valid with UFP_PACKET_TX_TSO */
 };
 
 #define UFP_PACKET_ERROR	0x00000001
 #define UFP_PACKET_EOF		0x00000002
+#define UFP_PACKET_HASH		0x00000004
+#define UFP_PACKET_CSUM		0x00000008 /* L3/L4 checksum checked */
+#define UFP_PACKET_CSUM_L3_BAD	0x00000010
+#define UFP_PACKET_CSUM_L4_BAD	0x00000020
+#define UFP_PACKET_TX_IPV4	0x00000100
+#define UFP_PACKET_TX_IPV6	0x00000200
+#define UFP_PACKET_TX_IP_CSUM	0x00000400
+#define UFP_PACKET_TX_TCP_CSUM	0x00000800
+#define UFP_PACKET_TX_UDP_CSUM	0x00001000
+#define UFP_PACKET_TX_TSO	0x00002000
+#define UFP_PACKET_TX_OFFLOAD	0x00003f00
+
+/* Outer L3 type parsed by NIC, regardless of VLAN tags */
+#define UFP_PTYPE_UNKNOWN	0
+#define UFP_PTYPE_ARP		1
+#define UFP_PTYPE_IPV4		2
+#define UFP_PTYPE_IPV6		3
 
 struct ufp_ops {
 	/* For configuration */
@@ -200,6 +279,38 @@ struct ufp_ops {
 	void	(*fill_tx_desc)(struct ufp_ring *tx_ring, uint16_t index,
 			uint64_t addr_dma, struct ufp_packet *packet);
 	int	(*fetch_tx_desc)(struct ufp_ring *tx_ring, uint16_t index);
+	/* Optional, returns 1 when a context descriptor is filled */
+	int	(*fill_tx_ctx_desc)(struct ufp_ring *tx_ring, uint16_t index,
+			struct ufp_packet *packet);
+	/* Optional, request status report of a filled TX descriptor */
+	void	(*set_tx_desc_rs)(struct ufp_ring *tx_ring, uint16_t index);
+
+	/*
+	 * Burst variants work on num descriptors from index without
+	 * wrapping around, and return the number of completed ones.
+	 */
+	unsigned int	(*fetch_rx_desc_burst)(struct ufp_ring *rx_ring,
+				uint16_t index, struct ufp_packet *packet,
+				unsigned int num);
+	unsigned int	(*fetch_tx_desc_burst)(struct ufp_ring *tx_ring,
+				uint16_t index, unsigned int num);
+	void	(*fill_rx_desc_burst)(struct ufp_ring *rx_ring, uint16_t index,
+			uint64_t *addr_dma, unsigned int num);
+
+	/*
+	 * Optional ring level routines with descriptor handling inlined,
+	 * see lib_burst.h. Generic ones are used when NULL.
+	 */
+	unsigned int	(*rx_clean)(struct ufp_plane *plane,
+				unsigned int port_idx, struct ufp_buf *buf,
+				struct ufp_packet *packet);
+	void	(*rx_assign)(struct ufp_plane *plane, unsigned int port_idx,
+			struct ufp_buf *buf);
+	unsigned int	(*tx_assign)(struct ufp_plane *plane,
+				unsigned int port_idx, struct ufp_buf *buf,
+				struct ufp_packet **packet, unsigned int num);
+	void	(*tx_clean)(struct ufp_plane *plane, unsigned int port_idx,
+			struct ufp_buf *buf);
 };
 
 enum ufp_irq_type {
@@ -207,6 +318,7 @@ enum ufp_irq_type {
 	UFP_IRQ_TX,
 };
 
+int ufp_mpool_grow(struct ufp_mpool *mpool, size_t size);
 inline uint32_t ufp_readl(const volatile void *addr);
 inline void ufp_writel(uint32_t b, volatile void *addr);
 
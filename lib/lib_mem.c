@@ -3,103 +3,143 @@
 #include <string.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <unistd.h>
 #include <net/ethernet.h>
 
 #include "lib_main.h"
 #include "lib_mem.h"
 
-static struct ufp_mnode *ufp_mnode_alloc(struct ufp_mnode *parent,
-	void *ptr, size_t size, unsigned int index);
-static void ufp_mnode_release(struct ufp_mnode *node);
-static void _ufp_mem_destroy(struct ufp_mnode *node);
-static struct ufp_mnode *_ufp_mem_alloc(struct ufp_mnode *node,
-	size_t size);
-static void _ufp_mem_free(struct ufp_mnode *node);
-
-static struct ufp_mnode *ufp_mnode_alloc(struct ufp_mnode *parent,
-	void *ptr, size_t size, unsigned int index)
+static unsigned int ufp_mem_order(size_t size);
+static struct ufp_mchunk *ufp_mem_chunk(struct ufp_mpool *mpool,
+	void *addr);
+static void ufp_mem_block_add(struct ufp_mpool *mpool,
+	struct ufp_mchunk *chunk, size_t offset, unsigned int order);
+static void ufp_mem_block_del(struct ufp_mpool *mpool,
+	struct ufp_mchunk *chunk, size_t offset, unsigned int order);
+static void *_ufp_mem_alloc(struct ufp_mpool *mpool, unsigned int order);
+static void *ufp_mem_block_take(struct ufp_mpool *mpool,
+	unsigned int order);
+static void _ufp_mem_free(struct ufp_mpool *mpool,
+	struct ufp_mchunk *chunk, size_t offset);
+static int ufp_mcache_grow(struct ufp_mcache *cache);
+
+/*
+ * Buddy allocator with a free list per order.
+ * Free lists are linked through free blocks, and the order of each block
+ * is kept in a byte array reserved at the head of each chunk.
+ * The byte is non-zero only at the head of a block, with UFP_MEM_FREE
+ * while the block is on a free list.
+ */
+void ufp_mem_init(struct ufp_mpool *mpool)
 {
-	struct ufp_mnode *node;
-
-	node = malloc(sizeof(struct ufp_mnode));
-	if(!node)
-		goto err_alloc_node;
+	int i;
 
-	node->parent	= parent;
-	node->child[0]	= NULL;
-	node->child[1]	= NULL;
-	node->allocated	= 0;
-	node->index	= index;
-	node->size	= size;
-	node->ptr	= ptr;
+	mpool->num_chunks = 0;
+	mpool->size = 0;
 
-	return node;
+	for(i = 0; i <= UFP_MEM_MAX_ORDER; i++){
+		list_init(&mpool->free[i]);
+		mpool->num_free[i] = 0;
+	}
 
-err_alloc_node:
-	return NULL;
+	return;
 }
 
-static void ufp_mnode_release(struct ufp_mnode *node)
+int ufp_mem_add(struct ufp_mpool *mpool, void *ptr, size_t size)
 {
-	struct ufp_mnode *parent;
+	struct ufp_mchunk *chunk;
+	size_t num_blocks, size_meta, offset;
+	unsigned int order;
+
+	if(mpool->num_chunks == UFP_MPOOL_MAX_CHUNKS)
+		goto err_chunks;
+
+	size &= ~((1ul << UFP_MEM_MIN_ORDER) - 1);
+	num_blocks = size >> UFP_MEM_MIN_ORDER;
+	size_meta = ALIGN(num_blocks, 1ul << UFP_MEM_MIN_ORDER);
+	if(size_meta >= size)
+		goto err_size;
+
+	chunk = &mpool->chunks[mpool->num_chunks++];
+	chunk->addr_virt = ptr;
+	chunk->dma_mapped = 0;
+	chunk->size = size;
+	chunk->order = ptr;
+	memset(chunk->order, 0, num_blocks);
+	mpool->size += size;
+
+	/* Rest of the chunk is carved into the largest aligned blocks */
+	for(offset = size_meta; offset < size; offset += 1ul << order){
+		order = min((unsigned int)__builtin_ctzl(offset),
+			(unsigned int)UFP_MEM_MAX_ORDER);
+		while(offset + (1ul << order) > size)
+			order--;
+
+		ufp_mem_block_add(mpool, chunk, offset, order);
+	}
 
-	parent = node->parent;
-	if(parent)
-		parent->child[node->index] = NULL;
+	return 0;
 
-	free(node);
-	return;
+err_size:
+err_chunks:
+	return -1;
 }
 
-struct ufp_mnode *ufp_mem_init(void *ptr, size_t size)
+static unsigned int ufp_mem_order(size_t size)
 {
-	struct ufp_mnode *root;
+	if(size <= (1ul << UFP_MEM_MIN_ORDER))
+		return UFP_MEM_MIN_ORDER;
 
-	root = ufp_mnode_alloc(NULL, ptr, size, 0);
-	if(!root)
-		goto err_alloc_root;
+	return 64 - __builtin_clzl(size - 1);
+}
 
-	return root;
+static struct ufp_mchunk *ufp_mem_chunk(struct ufp_mpool *mpool,
+	void *addr)
+{
+	struct ufp_mchunk *chunk;
+	int i;
+
+	for(i = 0; i < mpool->num_chunks; i++){
+		chunk = &mpool->chunks[i];
+		if(addr >= chunk->addr_virt
+		&& addr < chunk->addr_virt + chunk->size)
+			return chunk;
+	}
 
-err_alloc_root:
 	return NULL;
 }
 
-void ufp_mem_destroy(struct ufp_mnode *node)
+static void ufp_mem_block_add(struct ufp_mpool *mpool,
+	struct ufp_mchunk *chunk, size_t offset, unsigned int order)
 {
-	_ufp_mem_destroy(node);
+	list_add_first(&mpool->free[order], chunk->addr_virt + offset);
+	chunk->order[offset >> UFP_MEM_MIN_ORDER] = UFP_MEM_FREE | order;
+	mpool->num_free[order]++;
+	return;
 }
 
-static void _ufp_mem_destroy(struct ufp_mnode *node)
+static void ufp_mem_block_del(struct ufp_mpool *mpool,
+	struct ufp_mchunk *chunk, size_t offset, unsigned int order)
 {
-	struct ufp_mnode *child;
-	int i;
-
-	for(i = 0; i < 2; i++){
-		child = node->child[i];
-		if(child)
-			_ufp_mem_destroy(child);
-	}
-
-	ufp_mnode_release(node);
+	list_del(chunk->addr_virt + offset);
+	chunk->order[offset >> UFP_MEM_MIN_ORDER] = 0;
+	mpool->num_free[order]--;
 	return;
 }
 
 void *ufp_mem_alloc(struct ufp_mpool *mpool, size_t size)
 {
-	struct ufp_mnode *node;
 	void **header;
 	size_t size_header;
 
 	size_header = sizeof(void *);
 
-	node = _ufp_mem_alloc(mpool->node, size_header + size);
-	if(!node)
+	header = _ufp_mem_alloc(mpool, ufp_mem_order(size_header + size));
+	if(!header)
 		goto err_alloc;
 
-	header = node->ptr;
-	*header = node;
-	return node->ptr + size_header;
+	*header = mpool;
+	return (void *)header + size_header;
 
 err_alloc:
 	return NULL;
@@ -108,108 +148,253 @@ err_alloc:
 void *ufp_mem_alloc_align(struct ufp_mpool *mpool, size_t size,
 	size_t align)
 {
-	struct ufp_mnode *node;
-	void **header;
-	size_t size_header, offset;
+	void *block, **header;
+	size_t size_header;
 
 	size_header = sizeof(void *);
 	align = max(align, (size_t)getpagesize());
 
-	node = _ufp_mem_alloc(mpool->node, align + size_header + size);
-	if(!node)
+	/* Blocks larger than align are aligned, header goes before it */
+	block = _ufp_mem_alloc(mpool, ufp_mem_order(align + size));
+	if(!block)
 		goto err_alloc;
 
-	offset = align - ((size_t)node->ptr + size_header) % align;
-	header = node->ptr + offset;
-	*header = node;
-	return node->ptr + offset + size_header;
+	header = block + align - size_header;
+	*header = mpool;
+	return block + align;
 
 err_alloc:
 	return NULL;
 }
 
-static struct ufp_mnode *_ufp_mem_alloc(struct ufp_mnode *node,
-	size_t size)
-{
-	void *ptr_new;
-	struct ufp_mnode *ret;
-	size_t size_new;
-	int i, buddy_allocated;
-
-	ret = NULL;
-
-	if(!node)
-		goto ign_node;
-
-	if((node->size >> 1) < size){
-		if(!node->allocated
-		&& node->size >= size){
-			ret = node;
-		}
-	}else{
-		if(!node->allocated){
-			size_new = node->size >> 1;
-			for(i = 0, buddy_allocated = 0; i < 2; i++, buddy_allocated++){
-				ptr_new = node->ptr + (size_new * i);
-
-				node->child[i] = ufp_mnode_alloc(node, ptr_new, size_new, i);
-				if(!node->child[i])
-					goto err_alloc_child;
-			}
-		}
-
-		for(i = 0; i < 2; i++){
-			ret = _ufp_mem_alloc(node->child[i], size);
-			if(ret)
-				break;
-		}
+static void *_ufp_mem_alloc(struct ufp_mpool *mpool, unsigned int order)
+{
+	void *block;
+	int err;
+
+	if(order > UFP_MEM_MAX_ORDER)
+		goto err_order;
+
+	block = ufp_mem_block_take(mpool, order);
+	if(block)
+		goto out;
+
+	/* Chunk of twice the order always has a free block of the order */
+	err = ufp_mpool_grow(mpool, max(mpool->size_grow, 2ul << order));
+	if(err < 0)
+		goto err_grow;
+
+	block = ufp_mem_block_take(mpool, order);
+
+out:
+	return block;
+
+err_grow:
+err_order:
+	return NULL;
+}
+
+static void *ufp_mem_block_take(struct ufp_mpool *mpool,
+	unsigned int order)
+{
+	struct ufp_mchunk *chunk;
+	struct list_node *node;
+	unsigned int order_free;
+	size_t offset;
+
+	for(order_free = order; order_free <= UFP_MEM_MAX_ORDER; order_free++){
+		if(!list_empty(&mpool->free[order_free]))
+			break;
 	}
 
-	if(ret)
-		node->allocated = 1;
+	if(order_free > UFP_MEM_MAX_ORDER)
+		goto err_no_block;
+
+	node = mpool->free[order_free].node.next;
+	chunk = ufp_mem_chunk(mpool, node);
+	offset = (void *)node - chunk->addr_virt;
+	ufp_mem_block_del(mpool, chunk, offset, order_free);
 
-ign_node:
-	return ret;
+	/* Upper halves go back to the free lists */
+	while(order_free > order){
+		order_free--;
+		ufp_mem_block_add(mpool, chunk,
+			offset + (1ul << order_free), order_free);
+	}
+
+	chunk->order[offset >> UFP_MEM_MIN_ORDER] = order;
+	return chunk->addr_virt + offset;
 
-err_alloc_child:
-	for(i = 0; i < buddy_allocated; i++)
-		ufp_mnode_release(node->child[i]);
+err_no_block:
 	return NULL;
 }
 
 void ufp_mem_free(void *addr_free)
 {
-	struct ufp_mnode *node;
+	struct ufp_mpool *mpool;
+	struct ufp_mchunk *chunk;
 	void **header;
-	size_t size_header;
+	size_t size_header, offset, head;
+	unsigned int order;
 
 	size_header = sizeof(void *);
 	header = addr_free - size_header;
-	node = (struct ufp_mnode *)*header;
-	_ufp_mem_free(node);
+	mpool = *header;
+	chunk = ufp_mem_chunk(mpool, header);
+	offset = (void *)header - chunk->addr_virt;
+
+	/* First non-zero order byte aligned below the header is the head */
+	for(order = UFP_MEM_MIN_ORDER; order <= UFP_MEM_MAX_ORDER; order++){
+		head = offset & ~((1ul << order) - 1);
+		if(chunk->order[head >> UFP_MEM_MIN_ORDER])
+			break;
+	}
+
+	_ufp_mem_free(mpool, chunk, head);
 	return;
 }
 
-static void _ufp_mem_free(struct ufp_mnode *node)
+static void _ufp_mem_free(struct ufp_mpool *mpool,
+	struct ufp_mchunk *chunk, size_t offset)
 {
-	struct ufp_mnode *parent, *buddy;
+	unsigned int order;
+	size_t buddy;
 
-	node->allocated = 0;
+	order = chunk->order[offset >> UFP_MEM_MIN_ORDER];
+	chunk->order[offset >> UFP_MEM_MIN_ORDER] = 0;
 
-	parent = node->parent;
-	if(!parent)
-		goto out;
+	while(order < UFP_MEM_MAX_ORDER){
+		buddy = offset ^ (1ul << order);
+		if(buddy + (1ul << order) > chunk->size)
+			break;
 
-	buddy = parent->child[!node->index];
-	if(buddy->allocated)
-		goto out;
+		if(chunk->order[buddy >> UFP_MEM_MIN_ORDER]
+		!= (UFP_MEM_FREE | order))
+			break;
 
-	ufp_mnode_release(buddy);
-	ufp_mnode_release(node);
-	_ufp_mem_free(parent);
+		ufp_mem_block_del(mpool, chunk, buddy, order);
+		offset &= ~(1ul << order);
+		order++;
+	}
 
+	ufp_mem_block_add(mpool, chunk, offset, order);
 	return;
+}
 
-out:
+void ufp_mem_stats(struct ufp_mpool *mpool, struct ufp_mem_stats *stats)
+{
+	unsigned long largest;
+	int i;
+
+	stats->size = mpool->size;
+	stats->free = 0;
+	largest = 0;
+
+	for(i = 0; i <= UFP_MEM_MAX_ORDER; i++){
+		stats->free_order[i] = mpool->num_free[i] << i;
+		stats->free += stats->free_order[i];
+		if(mpool->num_free[i])
+			largest = 1ul << i;
+	}
+
+	/* Share of free memory unusable for the largest request */
+	stats->fragmentation = stats->free ?
+		100 - (largest * 100 / stats->free) : 0;
+	return;
+}
+
+struct ufp_mcache *ufp_mcache_alloc(struct ufp_mpool *mpool, size_t size)
+{
+	struct ufp_mcache *cache;
+	size_t slab_size;
+
+	cache = ufp_mem_alloc(mpool, sizeof(struct ufp_mcache));
+	if(!cache)
+		goto err_alloc_cache;
+
+	cache->mpool	= mpool;
+	cache->free	= NULL;
+	cache->slabs	= NULL;
+	cache->obj_size	= ALIGN(max(size, sizeof(void *)), sizeof(void *));
+
+	slab_size = UFP_MCACHE_SLAB_SIZE;
+	while(slab_size < sizeof(struct ufp_mslab)
+	+ cache->obj_size * UFP_MCACHE_MIN_OBJS)
+		slab_size <<= 1;
+
+	cache->slab_size = slab_size;
+	cache->num_objs = (slab_size - sizeof(void *)
+		- sizeof(struct ufp_mslab)) / cache->obj_size;
+
+	return cache;
+
+err_alloc_cache:
+	return NULL;
+}
+
+void ufp_mcache_release(struct ufp_mcache *cache)
+{
+	struct ufp_mslab *slab, *next;
+
+	for(slab = cache->slabs; slab; slab = next){
+		next = slab->next;
+		ufp_mem_free(slab);
+	}
+
+	ufp_mem_free(cache);
+	return;
+}
+
+static int ufp_mcache_grow(struct ufp_mcache *cache)
+{
+	struct ufp_mslab *slab;
+	void *obj;
+	int i;
+
+	/* Header of ufp_mem_alloc() is included to fit in a buddy node */
+	slab = ufp_mem_alloc(cache->mpool,
+		cache->slab_size - sizeof(void *));
+	if(!slab)
+		goto err_alloc_slab;
+
+	slab->next = cache->slabs;
+	cache->slabs = slab;
+
+	obj = (void *)slab + sizeof(struct ufp_mslab);
+	for(i = 0; i < cache->num_objs; i++, obj += cache->obj_size){
+		*(void **)obj = cache->free;
+		cache->free = obj;
+	}
+
+	return 0;
+
+err_alloc_slab:
+	return -1;
+}
+
+void *ufp_mcache_get(struct ufp_mcache *cache)
+{
+	void *obj;
+	int ret;
+
+	if(!cache->free){
+		ret = ufp_mcache_grow(cache);
+		if(ret < 0)
+			goto err_grow;
+	}
+
+	obj = cache->free;
+	cache->free = *(void **)obj;
+	return obj;
+
+err_grow:
+	return NULL;
+}
+
+void ufp_mcache_put(struct ufp_mcache *cache, void *obj)
+{
+	/* Objects stay in the cache until it is released */
+	*(void **)obj = cache->free;
+	cache->free = obj;
 	return;
 }
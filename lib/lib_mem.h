@@ -1,20 +1,43 @@
 #ifndef _LIBUFP_MEM_H
 #define _LIBUFP_MEM_H
 
-struct ufp_mnode {
-	struct ufp_mnode	*child[2];
-	struct ufp_mnode	*parent;
-	unsigned int		allocated;
-	unsigned int		index;
-	size_t			size;
-	void			*ptr;
+#define UFP_MCACHE_SLAB_SIZE	(1 << 16) /* must be power of 2 */
+#define UFP_MCACHE_MIN_OBJS	8
+
+struct ufp_mem_stats {
+	unsigned long		size;
+	unsigned long		free;
+	unsigned long		free_order[UFP_MEM_MAX_ORDER + 1]; /* bytes */
+	unsigned int		fragmentation; /* percent */
+};
+
+/*
+ * Cache of fixed size objects carved from mpool in slabs.
+ * Like the mpool itself, it belongs to one thread and needs no lock.
+ */
+struct ufp_mslab {
+	struct ufp_mslab	*next;
+};
+
+struct ufp_mcache {
+	struct ufp_mpool	*mpool;
+	void			*free; /* linked through the first word */
+	struct ufp_mslab	*slabs;
+	size_t			obj_size;
+	size_t			slab_size;
+	unsigned int		num_objs;
 };
 
-struct ufp_mnode *ufp_mem_init(void *ptr, size_t size);
-void ufp_mem_destroy(struct ufp_mnode *node);
+void ufp_mem_init(struct ufp_mpool *mpool);
+int ufp_mem_add(struct ufp_mpool *mpool, void *ptr, size_t size);
 void *ufp_mem_alloc(struct ufp_mpool *mpool, size_t size);
 void *ufp_mem_alloc_align(struct ufp_mpool *mpool, size_t size,
 	size_t align);
 void ufp_mem_free(void *addr_free);
+void ufp_mem_stats(struct ufp_mpool *mpool, struct ufp_mem_stats *stats);
+struct ufp_mcache *ufp_mcache_alloc(struct ufp_mpool *mpool, size_t size);
+void ufp_mcache_release(struct ufp_mcache *cache);
+void *ufp_mcache_get(struct ufp_mcache *cache);
+void ufp_mcache_put(struct ufp_mcache *cache, void *obj);
 
 #endif /* _LIBUFP_MEM_H */
@@ -185,14 +185,23 @@ static int ufp_tun_iff(int fd, const char *if_name)
 	memset(&ifr, 0, sizeof(struct ifreq));
 	strncpy(ifr.ifr_name, if_name, IFNAMSIZ);
 
-	ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_MULTI_QUEUE;
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_MULTI_QUEUE | IFF_VNET_HDR;
 
 	err = ioctl(fd, TUNSETIFF, (void *)&ifr);
 	if(err < 0)
 		goto err_tun_ioctl;
 
+	/*
+	 * Kernel leaves L4 checksum to us, which is offloaded to NIC.
+	 * TSO is not advertised since a packet must fit in one slot.
+	 */
+	err = ioctl(fd, TUNSETOFFLOAD, TUN_F_CSUM);
+	if(err < 0)
+		goto err_tun_offload;
+
 	return 0;
 
+err_tun_offload:
 err_tun_ioctl:
 	return -1;
 }
@@ -0,0 +1,496 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <syslog.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <ufp.h>
+
+#include "main.h"
+#include "thread.h"
+#include "control.h"
+#include "epoll.h"
+#include "netlink.h"
+#include "fib.h"
+#include "neigh.h"
+#include "rcu.h"
+
+static int control_ring_push(struct control_ring *ring,
+	struct control_msg *msg);
+static void control_route_apply(struct fib *fib_inet,
+	struct fib *fib_inet6, struct control_msg *msg);
+static void control_neigh_apply(struct ufpd_thread *thread,
+	struct control_msg *msg);
+static void control_adj_apply(struct fib *fib_inet,
+	struct fib *fib_inet6, struct ufp_plane *plane,
+	struct control_msg *msg);
+static int control_fd_prepare(struct list_head *ep_desc_head);
+static void control_fd_destroy(struct list_head *ep_desc_head,
+	int fd_ep);
+static int control_wait(struct ufpd_control *control, int fd_ep);
+static inline int control_process_netlink(struct ufpd_control *control,
+	struct epoll_desc *ep_desc);
+static inline int control_process_signal(struct ufpd_control *control,
+	struct epoll_desc *ep_desc);
+
+struct control_ring *control_ring_alloc(unsigned int size)
+{
+	struct control_ring *ring;
+	int ret;
+
+	/* head and tail are written by different threads */
+	ret = posix_memalign((void **)&ring, 64,
+		sizeof(struct control_ring));
+	if(ret != 0)
+		goto err_ring_alloc;
+
+	ring->msgs = malloc(sizeof(struct control_msg) * size);
+	if(!ring->msgs)
+		goto err_msgs_alloc;
+
+	ring->efd = eventfd(0, EFD_NONBLOCK);
+	if(ring->efd < 0){
+		perror("failed to open eventfd");
+		goto err_open_eventfd;
+	}
+
+	ring->mask		= size - 1;
+	ring->head		= 0;
+	ring->tail		= 0;
+	ring->tail_kicked	= 0;
+
+	return ring;
+
+err_open_eventfd:
+	free(ring->msgs);
+err_msgs_alloc:
+	free(ring);
+err_ring_alloc:
+	return NULL;
+}
+
+void control_ring_release(struct control_ring *ring)
+{
+	close(ring->efd);
+	free(ring->msgs);
+	free(ring);
+	return;
+}
+
+static int control_ring_push(struct control_ring *ring,
+	struct control_msg *msg)
+{
+	unsigned int tail;
+	int retry = 0;
+
+	tail = ring->tail;
+
+	/* Let the worker catch up rather than dropping an update */
+	while(tail - ring->head > ring->mask){
+		if(retry++ >= CONTROL_PUSH_RETRY)
+			goto err_ring_full;
+
+		control_ring_kick(ring);
+		usleep(1000);
+	}
+
+	ring->msgs[tail & ring->mask] = *msg;
+
+	/* Record must be visible before the tail */
+	asm volatile("" ::: "memory");
+	ring->tail = tail + 1;
+	return 0;
+
+err_ring_full:
+	return -1;
+}
+
+void control_ring_kick(struct control_ring *ring)
+{
+	uint64_t val = 1;
+	int ret;
+
+	/* One wakeup covers every record pushed so far */
+	if(ring->tail_kicked == ring->tail)
+		return;
+
+	ring->tail_kicked = ring->tail;
+	ret = write(ring->efd, &val, sizeof(uint64_t));
+	if(ret < 0)
+		ufpd_log(LOG_ERR, "failed to kick worker");
+
+	return;
+}
+
+int control_ring_apply(struct control_ring *ring,
+	struct ufpd_thread *thread, unsigned int budget)
+{
+	struct control_msg *msg;
+	unsigned int head, tail;
+	int i;
+
+	head = ring->head;
+	tail = ring->tail;
+	asm volatile("" ::: "memory");
+
+	for(i = 0; i < budget && head != tail; i++, head++){
+		msg = &ring->msgs[head & ring->mask];
+
+		switch(msg->type){
+		case CONTROL_ROUTE_UPDATE:
+		case CONTROL_ROUTE_DELETE:
+			control_route_apply(thread->fib_inet,
+				thread->fib_inet6, msg);
+			break;
+		case CONTROL_NEIGH_ADD:
+		case CONTROL_NEIGH_DELETE:
+			control_neigh_apply(thread, msg);
+			break;
+		default:
+			break;
+		}
+	}
+
+	/* Slots must be consumed before they are handed back */
+	asm volatile("" ::: "memory");
+	ring->head = head;
+
+	return head != ring->tail;
+}
+
+void control_dispatch(struct ufpd_control *control,
+	struct control_msg *msg)
+{
+	int i, ret;
+
+	switch(msg->type){
+	case CONTROL_ROUTE_UPDATE:
+	case CONTROL_ROUTE_DELETE:
+		/* Shared FIB is updated only once, workers see it via RCU */
+		if(control->rcu){
+			control_route_apply(control->fib_inet,
+				control->fib_inet6, msg);
+			goto out;
+		}
+		break;
+	case CONTROL_NEIGH_ADD:
+	case CONTROL_NEIGH_DELETE:
+		/* Adjacencies in shared FIB, neighbor tables are per thread */
+		if(control->rcu){
+			control_adj_apply(control->fib_inet,
+				control->fib_inet6, control->plane, msg);
+		}
+		break;
+	default:
+		break;
+	}
+
+	for(i = 0; i < control->num_rings; i++){
+		ret = control_ring_push(control->rings[i], msg);
+		if(ret < 0)
+			ufpd_log(LOG_ERR,
+				"thread %d stalled, update dropped", i);
+	}
+
+out:
+	return;
+}
+
+static void control_route_apply(struct fib *fib_inet,
+	struct fib *fib_inet6, struct control_msg *msg)
+{
+	struct fib *fib;
+
+	switch(msg->family){
+	case AF_INET:
+		fib = fib_inet;
+		break;
+	case AF_INET6:
+		fib = fib_inet6;
+		break;
+	default:
+		goto out;
+		break;
+	}
+
+	switch(msg->type){
+	case CONTROL_ROUTE_UPDATE:
+		fib_route_update(fib, msg->family, msg->fib_type,
+			msg->addr, msg->prefix_len, msg->nexthops,
+			msg->num_nexthops, msg->id, msg->replace);
+		break;
+	case CONTROL_ROUTE_DELETE:
+		fib_route_delete(fib, msg->family,
+			msg->addr, msg->prefix_len, msg->id);
+		break;
+	default:
+		break;
+	}
+
+out:
+	return;
+}
+
+static void control_neigh_apply(struct ufpd_thread *thread,
+	struct control_msg *msg)
+{
+	struct neigh_table *neigh;
+
+	switch(msg->family){
+	case AF_INET:
+		neigh = thread->neigh_inet[msg->port_index];
+		break;
+	case AF_INET6:
+		neigh = thread->neigh_inet6[msg->port_index];
+		break;
+	default:
+		goto out;
+		break;
+	}
+
+	switch(msg->type){
+	case CONTROL_NEIGH_ADD:
+		neigh_add(neigh, msg->family, msg->addr, msg->mac);
+		break;
+	case CONTROL_NEIGH_DELETE:
+		neigh_delete(neigh, msg->family, msg->addr);
+		break;
+	default:
+		break;
+	}
+
+	/* Shared FIB is maintained by control thread */
+	if(!thread->rcu_reader){
+		control_adj_apply(thread->fib_inet, thread->fib_inet6,
+			thread->plane, msg);
+	}
+
+out:
+	return;
+}
+
+static void control_adj_apply(struct fib *fib_inet,
+	struct fib *fib_inet6, struct ufp_plane *plane,
+	struct control_msg *msg)
+{
+	struct fib *fib;
+
+	fib = (msg->family == AF_INET) ? fib_inet : fib_inet6;
+
+	switch(msg->type){
+	case CONTROL_NEIGH_ADD:
+		fib_neigh_update(fib, msg->addr, msg->port_index, msg->mac,
+			ufp_macaddr(plane, msg->port_index));
+		break;
+	case CONTROL_NEIGH_DELETE:
+		fib_neigh_delete(fib, msg->addr, msg->port_index);
+		break;
+	default:
+		break;
+	}
+
+	return;
+}
+
+void *control_process(void *data)
+{
+	struct ufpd_control	*control = data;
+	struct list_head	ep_desc_head;
+	int			fd_ep, ret;
+
+	ufpd_log(LOG_INFO, "control thread started");
+	control->read_size = getpagesize();
+	list_init(&ep_desc_head);
+
+	/* Prepare read buffer */
+	control->read_buf = malloc(control->read_size);
+	if(!control->read_buf)
+		goto err_alloc_read_buf;
+
+	fd_ep = control_fd_prepare(&ep_desc_head);
+	if(fd_ep < 0){
+		ufpd_log(LOG_ERR, "failed to epoll prepare");
+		goto err_epoll_prepare;
+	}
+
+	ret = control_wait(control, fd_ep);
+	if(ret < 0)
+		goto err_wait;
+
+err_wait:
+	control_fd_destroy(&ep_desc_head, fd_ep);
+err_epoll_prepare:
+	free(control->read_buf);
+err_alloc_read_buf:
+	pthread_kill(control->ptid, SIGINT);
+	return NULL;
+}
+
+static int control_fd_prepare(struct list_head *ep_desc_head)
+{
+	struct epoll_desc 	*ep_desc;
+	sigset_t		sigset;
+	struct sockaddr_nl	addr;
+	int			fd_ep, ret;
+
+	/* epoll fd preparing */
+	fd_ep = epoll_create(EPOLL_MAXEVENTS);
+	if(fd_ep < 0){
+		perror("failed to make epoll fd");
+		goto err_epoll_open;
+	}
+
+	/* signalfd preparing */
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGUSR1);
+	ep_desc = epoll_desc_alloc_signalfd(&sigset);
+	if(!ep_desc)
+		goto err_epoll_desc_signalfd;
+
+	list_add_last(ep_desc_head, &ep_desc->list);
+
+	ret = epoll_add(fd_ep, ep_desc, ep_desc->fd);
+	if(ret < 0){
+		perror("failed to add fd in epoll");
+		goto err_epoll_add_signalfd;
+	}
+
+	/* netlink preparing, the only socket in the process */
+	memset(&addr, 0, sizeof(struct sockaddr_nl));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_NEIGH | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+
+	ep_desc = epoll_desc_alloc_netlink(&addr);
+	if(!ep_desc)
+		goto err_epoll_desc_netlink;
+
+	list_add_last(ep_desc_head, &ep_desc->list);
+
+	ret = epoll_add(fd_ep, ep_desc, ep_desc->fd);
+	if(ret < 0){
+		perror("failed to add fd in epoll");
+		goto err_epoll_add_netlink;
+	}
+
+	return fd_ep;
+
+err_epoll_add_netlink:
+err_epoll_desc_netlink:
+err_epoll_add_signalfd:
+err_epoll_desc_signalfd:
+	control_fd_destroy(ep_desc_head, fd_ep);
+err_epoll_open:
+	return -1;
+}
+
+static void control_fd_destroy(struct list_head *ep_desc_head,
+	int fd_ep)
+{
+	struct epoll_desc *ep_desc, *temp;
+
+	list_for_each_safe(ep_desc_head, ep_desc, list, temp){
+		list_del(&ep_desc->list);
+		epoll_del(fd_ep, ep_desc->fd);
+
+		switch(ep_desc->type){
+		case EPOLL_SIGNAL:
+			epoll_desc_release_signalfd(ep_desc);
+			break;
+		case EPOLL_NETLINK:
+			epoll_desc_release_netlink(ep_desc);
+			break;
+		default:
+			break;
+		}
+	}
+
+	close(fd_ep);
+	return;
+}
+
+static int control_wait(struct ufpd_control *control, int fd_ep)
+{
+	struct epoll_desc *ep_desc;
+	struct epoll_event events[EPOLL_MAXEVENTS];
+	int i, err, num_fd, timeout;
+
+	while(1){
+		/* Wake up periodically while deferred objects remain */
+		timeout = (control->rcu && rcu_pending(control->rcu)) ?
+			RCU_RECLAIM_INTERVAL : -1;
+
+		num_fd = epoll_wait(fd_ep, events, EPOLL_MAXEVENTS, timeout);
+		if(num_fd < 0)
+			goto err_wait;
+
+		for(i = 0; i < num_fd; i++){
+			ep_desc = (struct epoll_desc *)events[i].data.ptr;
+
+			switch(ep_desc->type){
+			case EPOLL_NETLINK:
+				err = control_process_netlink(control, ep_desc);
+				if(err < 0)
+					goto err_process;
+				break;
+			case EPOLL_SIGNAL:
+				err = control_process_signal(control, ep_desc);
+				if(err < 0)
+					goto err_process;
+				goto out;
+				break;
+			default:
+				break;
+			}
+		}
+
+		if(control->rcu)
+			rcu_reclaim(control->rcu);
+	}
+
+out:
+	return 0;
+
+err_process:
+err_wait:
+	return -1;
+}
+
+static inline int control_process_netlink(struct ufpd_control *control,
+	struct epoll_desc *ep_desc)
+{
+	int ret, i;
+
+	ret = read(ep_desc->fd, control->read_buf, control->read_size);
+	if(ret < 0)
+		goto err_read;
+
+	netlink_process(control, control->read_buf, ret);
+
+	for(i = 0; i < control->num_rings; i++){
+		control_ring_kick(control->rings[i]);
+	}
+	return 0;
+
+err_read:
+	return -1;
+}
+
+static inline int control_process_signal(struct ufpd_control *control,
+	struct epoll_desc *ep_desc)
+{
+	int ret;
+
+	ret = read(ep_desc->fd, control->read_buf, control->read_size);
+	if(ret < 0)
+		goto err_read;
+	return 0;
+
+err_read:
+	return -1;
+}
@@ -0,0 +1,76 @@
+#ifndef _UFPD_CONTROL_H
+#define _UFPD_CONTROL_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <linux/if_ether.h>
+#include <ufp.h>
+#include "main.h"
+#include "fib.h"
+
+#define CONTROL_RING_SIZE 4096 /* must be power of 2 */
+#define CONTROL_BUDGET 64
+#define CONTROL_PUSH_RETRY 1000 /* ms */
+
+enum control_type {
+	CONTROL_ROUTE_UPDATE = 0,
+	CONTROL_ROUTE_DELETE,
+	CONTROL_NEIGH_ADD,
+	CONTROL_NEIGH_DELETE
+};
+
+/* netlink message parsed once by control thread */
+struct control_msg {
+	uint8_t			type;
+	uint8_t			family;
+	uint8_t			prefix_len;
+	uint8_t			fib_type;
+	uint8_t			replace;	/* route only */
+	int			id;
+	uint8_t			addr[16];	/* prefix or neighbor address */
+	int			port_index;	/* neighbor only */
+	uint8_t			mac[ETH_ALEN];	/* neighbor only */
+	unsigned int		num_nexthops;	/* route only */
+	struct fib_nexthop	nexthops[FIB_MULTIPATH_MAX];
+};
+
+/*
+ * Single producer (control thread) and single consumer (worker).
+ * Consumer index and producer index are placed on their own cache line.
+ */
+struct control_ring {
+	struct control_msg	*msgs;
+	unsigned int		mask;
+	int			efd;
+	volatile unsigned int	head __attribute__ ((aligned(64)));
+	volatile unsigned int	tail __attribute__ ((aligned(64)));
+	unsigned int		tail_kicked;
+} __attribute__ ((aligned(64)));
+
+struct ufpd_control {
+	struct ufp_plane	*plane;
+	unsigned int		num_ports;
+	struct ufp_mpool	*mpool;
+	struct fib		*fib_inet; /* NULL when FIB is private */
+	struct fib		*fib_inet6;
+	struct rcu		*rcu;
+	struct control_ring	**rings;
+	unsigned int		num_rings;
+	pthread_t		tid;
+	pthread_t		ptid;
+	uint8_t			*read_buf;
+	size_t			read_size;
+};
+
+struct ufpd_thread;
+
+struct control_ring *control_ring_alloc(unsigned int size);
+void control_ring_release(struct control_ring *ring);
+void control_ring_kick(struct control_ring *ring);
+int control_ring_apply(struct control_ring *ring,
+	struct ufpd_thread *thread, unsigned int budget);
+void control_dispatch(struct ufpd_control *control,
+	struct control_msg *msg);
+void *control_process(void *data);
+
+#endif /* _UFPD_CONTROL_H */
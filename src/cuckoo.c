@@ -0,0 +1,446 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <ufp.h>
+
+#include "main.h"
+#include "cuckoo.h"
+
+static int cuckoo_buckets_alloc(struct cuckoo_table *table,
+	unsigned int num_buckets);
+static int cuckoo_entries_alloc(struct cuckoo_table *table,
+	unsigned int num_entries);
+static int cuckoo_bucket_insert(struct cuckoo_bucket *bucket,
+	uint16_t sig, uint32_t index);
+static int cuckoo_bucket_remove(struct cuckoo_table *table,
+	struct cuckoo_bucket *bucket, uint16_t sig, void *key);
+static int cuckoo_insert(struct cuckoo_table *table, uint32_t bucket,
+	uint16_t *sig, uint32_t *index);
+static int cuckoo_insert_index(struct cuckoo_table *table,
+	uint32_t *index);
+static int cuckoo_rehash(struct cuckoo_table *table,
+	struct cuckoo_table *table_old, int index_homeless);
+static int cuckoo_grow(struct cuckoo_table *table, int index_homeless);
+
+struct cuckoo_table *cuckoo_alloc(struct ufp_mpool *mpool,
+	unsigned int key_len, unsigned int entry_size)
+{
+	struct cuckoo_table *table;
+	int ret;
+
+	table = ufp_mem_alloc(mpool, sizeof(struct cuckoo_table));
+	if(!table)
+		goto err_table_alloc;
+
+	table->mpool		= mpool;
+	table->key_len		= key_len;
+	table->entry_size	= entry_size;
+	table->entries		= NULL;
+	table->entries_free	= NULL;
+	table->entries_free_count = 0;
+	table->num_entries	= 0;
+
+	ret = cuckoo_buckets_alloc(table, CUCKOO_INIT_BUCKETS);
+	if(ret < 0)
+		goto err_buckets_alloc;
+
+	ret = cuckoo_entries_alloc(table,
+		CUCKOO_INIT_BUCKETS * CUCKOO_BUCKET_ENTRIES);
+	if(ret < 0)
+		goto err_entries_alloc;
+
+	return table;
+
+err_entries_alloc:
+	ufp_mem_free(table->buckets);
+err_buckets_alloc:
+	ufp_mem_free(table);
+err_table_alloc:
+	return NULL;
+}
+
+void cuckoo_release(struct cuckoo_table *table)
+{
+	ufp_mem_free(table->entries_free);
+	ufp_mem_free(table->entries);
+	ufp_mem_free(table->buckets);
+	ufp_mem_free(table);
+	return;
+}
+
+static int cuckoo_buckets_alloc(struct cuckoo_table *table,
+	unsigned int num_buckets)
+{
+	table->buckets = ufp_mem_alloc_align(table->mpool,
+		sizeof(struct cuckoo_bucket) * num_buckets, 64);
+	if(!table->buckets)
+		goto err_buckets_alloc;
+
+	memset(table->buckets, 0,
+		sizeof(struct cuckoo_bucket) * num_buckets);
+	table->mask = num_buckets - 1;
+	return 0;
+
+err_buckets_alloc:
+	return -1;
+}
+
+static int cuckoo_entries_alloc(struct cuckoo_table *table,
+	unsigned int num_entries)
+{
+	uint8_t *entries;
+	uint32_t *entries_free;
+	int i;
+
+	entries = ufp_mem_alloc(table->mpool,
+		table->entry_size * num_entries);
+	if(!entries)
+		goto err_entries_alloc;
+
+	entries_free = ufp_mem_alloc(table->mpool,
+		sizeof(uint32_t) * num_entries);
+	if(!entries_free)
+		goto err_entries_free_alloc;
+
+	/* Indexes are kept across growth, buckets need not be updated */
+	if(table->entries){
+		memcpy(entries, table->entries,
+			table->entry_size * table->num_entries);
+		memcpy(entries_free, table->entries_free,
+			sizeof(uint32_t) * table->entries_free_count);
+		ufp_mem_free(table->entries);
+		ufp_mem_free(table->entries_free);
+	}
+
+	for(i = num_entries - 1; i >= (int)table->num_entries; i--){
+		entries_free[table->entries_free_count++] = i;
+	}
+
+	table->entries		= entries;
+	table->entries_free	= entries_free;
+	table->num_entries	= num_entries;
+	return 0;
+
+err_entries_free_alloc:
+	ufp_mem_free(entries);
+err_entries_alloc:
+	return -1;
+}
+
+static int cuckoo_bucket_insert(struct cuckoo_bucket *bucket,
+	uint16_t sig, uint32_t index)
+{
+	int i;
+
+	for(i = 0; i < CUCKOO_BUCKET_ENTRIES; i++){
+		if(!bucket->sig[i]){
+			bucket->index[i] = index;
+			bucket->sig[i] = sig;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static int cuckoo_bucket_remove(struct cuckoo_table *table,
+	struct cuckoo_bucket *bucket, uint16_t sig, void *key)
+{
+	unsigned int match;
+	void *entry;
+	int slot;
+
+	match = cuckoo_bucket_match(bucket, sig);
+	while(match){
+		slot = __builtin_ctz(match);
+		match &= match - 1;
+
+		entry = table->entries
+			+ bucket->index[slot] * table->entry_size;
+		if(!cuckoo_key_compare(table, key, entry)){
+			bucket->sig[slot] = 0;
+			table->entries_free[table->entries_free_count++] =
+				bucket->index[slot];
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static int cuckoo_insert(struct cuckoo_table *table, uint32_t bucket,
+	uint16_t *sig, uint32_t *index)
+{
+	uint32_t path_bucket[CUCKOO_MAX_DISPLACE];
+	int path_slot[CUCKOO_MAX_DISPLACE];
+	uint16_t sig_victim;
+	uint32_t index_victim;
+	int i, slot;
+
+	if(!cuckoo_bucket_insert(&table->buckets[bucket], *sig, *index))
+		return 0;
+
+	bucket = cuckoo_alternative(table, bucket, *sig);
+	if(!cuckoo_bucket_insert(&table->buckets[bucket], *sig, *index))
+		return 0;
+
+	/* Both are full, kick a victim out to its alternative bucket */
+	for(i = 0; i < CUCKOO_MAX_DISPLACE; i++){
+		slot = (*index + i) % CUCKOO_BUCKET_ENTRIES;
+
+		sig_victim = table->buckets[bucket].sig[slot];
+		index_victim = table->buckets[bucket].index[slot];
+		table->buckets[bucket].sig[slot] = *sig;
+		table->buckets[bucket].index[slot] = *index;
+		*sig = sig_victim;
+		*index = index_victim;
+
+		path_bucket[i] = bucket;
+		path_slot[i] = slot;
+
+		bucket = cuckoo_alternative(table, bucket, *sig);
+		if(!cuckoo_bucket_insert(&table->buckets[bucket], *sig, *index))
+			return 0;
+	}
+
+	/* Undo the displacement, so that only the new one is left out */
+	while(--i >= 0){
+		bucket = path_bucket[i];
+		slot = path_slot[i];
+
+		sig_victim = table->buckets[bucket].sig[slot];
+		index_victim = table->buckets[bucket].index[slot];
+		table->buckets[bucket].sig[slot] = *sig;
+		table->buckets[bucket].index[slot] = *index;
+		*sig = sig_victim;
+		*index = index_victim;
+	}
+
+	return -1;
+}
+
+static int cuckoo_insert_index(struct cuckoo_table *table,
+	uint32_t *index)
+{
+	uint64_t hash;
+	uint16_t sig;
+
+	hash = cuckoo_hash(table,
+		table->entries + *index * table->entry_size);
+	sig = cuckoo_sig(hash);
+
+	return cuckoo_insert(table, cuckoo_primary(table, hash),
+		&sig, index);
+}
+
+static int cuckoo_rehash(struct cuckoo_table *table,
+	struct cuckoo_table *table_old, int index_homeless)
+{
+	struct cuckoo_bucket *bucket;
+	uint32_t index;
+	int i, j, ret;
+
+	for(i = 0; i <= table_old->mask; i++){
+		bucket = &table_old->buckets[i];
+
+		for(j = 0; j < CUCKOO_BUCKET_ENTRIES; j++){
+			if(!bucket->sig[j])
+				continue;
+
+			index = bucket->index[j];
+			ret = cuckoo_insert_index(table, &index);
+			if(ret < 0)
+				goto err_insert;
+		}
+	}
+
+	if(index_homeless >= 0){
+		index = index_homeless;
+		ret = cuckoo_insert_index(table, &index);
+		if(ret < 0)
+			goto err_insert;
+	}
+
+	return 0;
+
+err_insert:
+	return -1;
+}
+
+static int cuckoo_grow(struct cuckoo_table *table, int index_homeless)
+{
+	struct cuckoo_table table_old;
+	unsigned int num_buckets;
+	int ret;
+
+	table_old = *table;
+	num_buckets = (table->mask + 1) << 1;
+
+	/* Retry with larger one in case rehash fails again */
+	while(1){
+		ret = cuckoo_buckets_alloc(table, num_buckets);
+		if(ret < 0)
+			goto err_buckets_alloc;
+
+		ret = cuckoo_rehash(table, &table_old, index_homeless);
+		if(!ret)
+			break;
+
+		ufp_mem_free(table->buckets);
+		num_buckets <<= 1;
+	}
+
+	ufp_mem_free(table_old.buckets);
+
+	/* Table is consistent even if entries can't be expanded */
+	if(table->num_entries < num_buckets * CUCKOO_BUCKET_ENTRIES){
+		cuckoo_entries_alloc(table,
+			num_buckets * CUCKOO_BUCKET_ENTRIES);
+	}
+
+	return 0;
+
+err_buckets_alloc:
+	table->buckets = table_old.buckets;
+	table->mask = table_old.mask;
+	return -1;
+}
+
+void *cuckoo_add(struct cuckoo_table *table, void *key)
+{
+	uint8_t *entry;
+	uint32_t index;
+	int ret;
+
+	entry = cuckoo_lookup(table, key);
+	if(entry)
+		goto out;
+
+	/* Grow before cuckoo path gets long */
+	if(table->entries_free_count < (table->num_entries >> 3)){
+		ret = cuckoo_grow(table, -1);
+		if(ret < 0 && !table->entries_free_count)
+			goto err_grow;
+	}
+
+	index = table->entries_free[--table->entries_free_count];
+	entry = table->entries + index * table->entry_size;
+	memset(entry, 0, table->entry_size);
+	memcpy(entry, key, table->key_len);
+
+	ret = cuckoo_insert_index(table, &index);
+	if(ret < 0){
+		ret = cuckoo_grow(table, index);
+		if(ret < 0)
+			goto err_insert;
+
+		/* Entries might be moved */
+		entry = cuckoo_lookup(table, key);
+	}
+
+out:
+	return entry;
+
+err_insert:
+	/* Table is left as it was, without the new entry */
+	table->entries_free[table->entries_free_count++] = index;
+err_grow:
+	return NULL;
+}
+
+int cuckoo_delete(struct cuckoo_table *table, void *key)
+{
+	uint64_t hash;
+	uint32_t index;
+	uint16_t sig;
+	int ret;
+
+	hash = cuckoo_hash(table, key);
+	sig = cuckoo_sig(hash);
+	index = cuckoo_primary(table, hash);
+
+	ret = cuckoo_bucket_remove(table, &table->buckets[index], sig, key);
+	if(!ret)
+		goto out;
+
+	index = cuckoo_alternative(table, index, sig);
+	ret = cuckoo_bucket_remove(table, &table->buckets[index], sig, key);
+
+out:
+	return ret;
+}
+
+void cuckoo_lookup_bulk(struct cuckoo_table **table, void **key,
+	void **entry, int num)
+{
+	struct cuckoo_bucket *primary[CUCKOO_LOOKUP_BULK];
+	struct cuckoo_bucket *secondary[CUCKOO_LOOKUP_BULK];
+	unsigned int match_primary[CUCKOO_LOOKUP_BULK];
+	unsigned int match_secondary[CUCKOO_LOOKUP_BULK];
+	uint16_t sig[CUCKOO_LOOKUP_BULK];
+	uint64_t hash;
+	uint32_t index;
+	int base, n, i;
+
+	for(base = 0; base < num; base += CUCKOO_LOOKUP_BULK){
+		n = min(num - base, CUCKOO_LOOKUP_BULK);
+
+		/* Stage 1: Locate candidate buckets */
+		for(i = 0; i < n; i++){
+			if(!table[base + i])
+				continue;
+
+			hash = cuckoo_hash(table[base + i], key[base + i]);
+			sig[i] = cuckoo_sig(hash);
+			index = cuckoo_primary(table[base + i], hash);
+			primary[i] = &table[base + i]->buckets[index];
+			secondary[i] = &table[base + i]->buckets[
+				cuckoo_alternative(table[base + i],
+				index, sig[i])];
+
+			prefetch(primary[i]);
+			prefetch(secondary[i]);
+		}
+
+		/* Stage 2: Compare signatures, prefetch first candidate */
+		for(i = 0; i < n; i++){
+			if(!table[base + i])
+				continue;
+
+			cuckoo_bucket_match2(primary[i], secondary[i], sig[i],
+				&match_primary[i], &match_secondary[i]);
+
+			if(match_primary[i]){
+				prefetch(table[base + i]->entries
+					+ primary[i]->index[
+					__builtin_ctz(match_primary[i])]
+					* table[base + i]->entry_size);
+			}else if(match_secondary[i]){
+				prefetch(table[base + i]->entries
+					+ secondary[i]->index[
+					__builtin_ctz(match_secondary[i])]
+					* table[base + i]->entry_size);
+			}
+		}
+
+		/* Stage 3: Compare keys */
+		for(i = 0; i < n; i++){
+			entry[base + i] = NULL;
+
+			if(!table[base + i])
+				continue;
+
+			entry[base + i] = cuckoo_bucket_search(table[base + i],
+				primary[i], match_primary[i], key[base + i]);
+			if(entry[base + i])
+				continue;
+
+			entry[base + i] = cuckoo_bucket_search(table[base + i],
+				secondary[i], match_secondary[i], key[base + i]);
+		}
+	}
+
+	return;
+}
@@ -0,0 +1,187 @@
+#ifndef _UFPD_CUCKOO_H
+#define _UFPD_CUCKOO_H
+
+#include <stdint.h>
+#include <ufp.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+#include "main.h"
+#include "hash.h"
+
+#define CUCKOO_BUCKET_ENTRIES 8
+#define CUCKOO_INIT_BUCKETS 64 /* must be power of 2 */
+#define CUCKOO_MAX_DISPLACE 128
+#define CUCKOO_LOOKUP_BULK 32
+
+/*
+ * Bucket fits in a cache line. Signature 0 means empty slot,
+ * and each slot points the entry which holds the key inline.
+ */
+struct cuckoo_bucket {
+	uint16_t		sig[CUCKOO_BUCKET_ENTRIES];
+	uint32_t		index[CUCKOO_BUCKET_ENTRIES];
+} __attribute__ ((aligned(64)));
+
+struct cuckoo_table {
+	struct cuckoo_bucket	*buckets;
+	uint32_t		mask;
+	uint8_t			*entries; /* key at the head of each entry */
+	unsigned int		entry_size;
+	unsigned int		key_len; /* 4 or 16 */
+	uint32_t		*entries_free;
+	unsigned int		entries_free_count;
+	unsigned int		num_entries;
+	struct ufp_mpool	*mpool;
+};
+
+struct cuckoo_table *cuckoo_alloc(struct ufp_mpool *mpool,
+	unsigned int key_len, unsigned int entry_size);
+void cuckoo_release(struct cuckoo_table *table);
+void *cuckoo_add(struct cuckoo_table *table, void *key);
+int cuckoo_delete(struct cuckoo_table *table, void *key);
+void cuckoo_lookup_bulk(struct cuckoo_table **table, void **key,
+	void **entry, int num);
+
+static inline uint64_t cuckoo_hash(struct cuckoo_table *table, void *key)
+{
+	uint64_t hash;
+
+	if(table->key_len == 4){
+		hash = *(uint32_t *)key * GOLDEN_RATIO_PRIME_64;
+	}else{
+		hash = ((uint64_t *)key)[0] * GOLDEN_RATIO_PRIME_64;
+		hash = (hash ^ ((uint64_t *)key)[1]) * GOLDEN_RATIO_PRIME_64;
+	}
+
+	return hash;
+}
+
+static inline uint16_t cuckoo_sig(uint64_t hash)
+{
+	uint16_t sig;
+
+	/* Bits independent of bucket index */
+	sig = hash >> 16;
+	return sig ? sig : 1;
+}
+
+static inline uint32_t cuckoo_primary(struct cuckoo_table *table,
+	uint64_t hash)
+{
+	return (hash >> 32) & table->mask;
+}
+
+static inline uint32_t cuckoo_alternative(struct cuckoo_table *table,
+	uint32_t index, uint16_t sig)
+{
+	/* Either bucket can be derived from the other without key */
+	return (index ^ (sig * 0x5bd1e995)) & table->mask;
+}
+
+static inline unsigned int cuckoo_bucket_match(
+	struct cuckoo_bucket *bucket, uint16_t sig)
+{
+#ifdef __SSE2__
+	__m128i cmp;
+
+	cmp = _mm_cmpeq_epi16(_mm_load_si128((__m128i *)bucket->sig),
+		_mm_set1_epi16(sig));
+
+	/* One bit per slot */
+	return _mm_movemask_epi8(_mm_packs_epi16(cmp, _mm_setzero_si128()));
+#else
+	unsigned int match;
+	int i;
+
+	match = 0;
+	for(i = 0; i < CUCKOO_BUCKET_ENTRIES; i++){
+		if(bucket->sig[i] == sig)
+			match |= 1 << i;
+	}
+
+	return match;
+#endif
+}
+
+static inline void cuckoo_bucket_match2(struct cuckoo_bucket *primary,
+	struct cuckoo_bucket *secondary, uint16_t sig,
+	unsigned int *match_primary, unsigned int *match_secondary)
+{
+#ifdef __AVX2__
+	__m256i cmp;
+	unsigned int match;
+
+	/* Both candidate buckets in one compare */
+	cmp = _mm256_cmpeq_epi16(_mm256_set_m128i(
+		_mm_load_si128((__m128i *)secondary->sig),
+		_mm_load_si128((__m128i *)primary->sig)),
+		_mm256_set1_epi16(sig));
+	cmp = _mm256_packs_epi16(cmp, _mm256_setzero_si256());
+	match = _mm256_movemask_epi8(cmp);
+
+	*match_primary = match & 0xff;
+	*match_secondary = (match >> 16) & 0xff;
+#else
+	*match_primary = cuckoo_bucket_match(primary, sig);
+	*match_secondary = cuckoo_bucket_match(secondary, sig);
+#endif
+	return;
+}
+
+static inline int cuckoo_key_compare(struct cuckoo_table *table,
+	void *key_tgt, void *key_ent)
+{
+	if(table->key_len == 4)
+		return *(uint32_t *)key_tgt != *(uint32_t *)key_ent;
+
+	return ((((uint64_t *)key_tgt)[0] ^ ((uint64_t *)key_ent)[0])
+		| (((uint64_t *)key_tgt)[1] ^ ((uint64_t *)key_ent)[1])) ?
+		1 : 0;
+}
+
+static inline void *cuckoo_bucket_search(struct cuckoo_table *table,
+	struct cuckoo_bucket *bucket, unsigned int match, void *key)
+{
+	void *entry;
+	int slot;
+
+	while(match){
+		slot = __builtin_ctz(match);
+		match &= match - 1;
+
+		entry = table->entries
+			+ bucket->index[slot] * table->entry_size;
+		if(!cuckoo_key_compare(table, key, entry))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static inline void *cuckoo_lookup(struct cuckoo_table *table, void *key)
+{
+	struct cuckoo_bucket *primary, *secondary;
+	unsigned int match_primary, match_secondary;
+	uint64_t hash;
+	uint32_t index;
+	uint16_t sig;
+	void *entry;
+
+	hash = cuckoo_hash(table, key);
+	sig = cuckoo_sig(hash);
+	index = cuckoo_primary(table, hash);
+	primary = &table->buckets[index];
+	secondary = &table->buckets[cuckoo_alternative(table, index, sig)];
+
+	cuckoo_bucket_match2(primary, secondary, sig,
+		&match_primary, &match_secondary);
+
+	entry = cuckoo_bucket_search(table, primary, match_primary, key);
+	if(entry)
+		return entry;
+
+	return cuckoo_bucket_search(table, secondary, match_secondary, key);
+}
+
+#endif /* _UFPD_CUCKOO_H */
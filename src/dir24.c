@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <stddef.h>
+#include <ufp.h>
+
+#include "main.h"
+#include "dir24.h"
+
+static uint32_t dir24_mask(unsigned int prefix_len);
+static int dir24_tbl8_alloc(struct dir24_table *table, uint32_t fill);
+static void dir24_tbl8_release(struct dir24_table *table,
+	unsigned int group);
+static void dir24_tbl8_reclaim(void *arg, void *ptr);
+static void dir24_tbl8_collapse(struct dir24_table *table,
+	unsigned int index24);
+
+struct dir24_table *dir24_alloc(struct ufp_mpool *mpool, struct rcu *rcu)
+{
+	struct dir24_table *table;
+	int i;
+
+	table = ufp_mem_alloc(mpool, sizeof(struct dir24_table));
+	if(!table)
+		goto err_table_alloc;
+
+	table->tbl24 = ufp_mem_alloc(mpool,
+		sizeof(uint32_t) * DIR24_TBL24_SIZE);
+	if(!table->tbl24)
+		goto err_tbl24_alloc;
+
+	table->tbl8 = ufp_mem_alloc(mpool,
+		sizeof(uint32_t) * DIR24_TBL8_SIZE * DIR24_TBL8_GROUPS);
+	if(!table->tbl8)
+		goto err_tbl8_alloc;
+
+	table->tbl8_free = ufp_mem_alloc(mpool,
+		sizeof(uint32_t) * DIR24_TBL8_GROUPS);
+	if(!table->tbl8_free)
+		goto err_tbl8_free_alloc;
+
+	memset(table->tbl24, 0, sizeof(uint32_t) * DIR24_TBL24_SIZE);
+
+	/* Pop lower group index first */
+	for(i = 0; i < DIR24_TBL8_GROUPS; i++){
+		table->tbl8_free[i] = DIR24_TBL8_GROUPS - 1 - i;
+	}
+	table->tbl8_free_count = DIR24_TBL8_GROUPS;
+	table->rcu = rcu;
+
+	return table;
+
+err_tbl8_free_alloc:
+	ufp_mem_free(table->tbl8);
+err_tbl8_alloc:
+	ufp_mem_free(table->tbl24);
+err_tbl24_alloc:
+	ufp_mem_free(table);
+err_table_alloc:
+	return NULL;
+}
+
+void dir24_release(struct dir24_table *table)
+{
+	ufp_mem_free(table->tbl8_free);
+	ufp_mem_free(table->tbl8);
+	ufp_mem_free(table->tbl24);
+	ufp_mem_free(table);
+	return;
+}
+
+static uint32_t dir24_mask(unsigned int prefix_len)
+{
+	return prefix_len ? ~((1ULL << (32 - prefix_len)) - 1) : 0;
+}
+
+static int dir24_tbl8_alloc(struct dir24_table *table, uint32_t fill)
+{
+	uint32_t *group;
+	unsigned int index;
+	int i;
+
+	if(!table->tbl8_free_count)
+		goto err_no_group;
+
+	index = table->tbl8_free[--table->tbl8_free_count];
+	group = &table->tbl8[index << 8];
+
+	/* Inherit the route which covered whole /24 */
+	for(i = 0; i < DIR24_TBL8_SIZE; i++){
+		group[i] = fill;
+	}
+
+	return index;
+
+err_no_group:
+	return -1;
+}
+
+static void dir24_tbl8_release(struct dir24_table *table,
+	unsigned int group)
+{
+	/* Readers may still walk the group until grace period */
+	rcu_defer(table->rcu, dir24_tbl8_reclaim, table,
+		&table->tbl8[group << 8]);
+	return;
+}
+
+static void dir24_tbl8_reclaim(void *arg, void *ptr)
+{
+	struct dir24_table *table;
+
+	table = arg;
+	table->tbl8_free[table->tbl8_free_count++] =
+		((uint32_t *)ptr - table->tbl8) >> 8;
+	return;
+}
+
+int dir24_add(struct dir24_table *table, void *prefix,
+	unsigned int prefix_len, uint32_t index)
+{
+	uint32_t addr, entry, new, *group;
+	unsigned int index24, range, i, j;
+	int ret;
+
+	addr = ntohl(*(uint32_t *)prefix) & dir24_mask(prefix_len);
+	new = dir24_entry(index, prefix_len);
+	index24 = addr >> 8;
+
+	if(prefix_len <= 24){
+		range = 1 << (24 - prefix_len);
+
+		for(i = 0; i < range; i++){
+			entry = table->tbl24[index24 + i];
+
+			if(!(entry & DIR24_ENTRY_GROUP)){
+				if(dir24_entry_depth(entry) <= prefix_len)
+					table->tbl24[index24 + i] = new;
+				continue;
+			}
+
+			group = &table->tbl8[dir24_entry_index(entry) << 8];
+			for(j = 0; j < DIR24_TBL8_SIZE; j++){
+				if(dir24_entry_depth(group[j]) <= prefix_len)
+					group[j] = new;
+			}
+		}
+	}else{
+		entry = table->tbl24[index24];
+
+		if(!(entry & DIR24_ENTRY_GROUP)){
+			ret = dir24_tbl8_alloc(table, entry);
+			if(ret < 0)
+				goto err_tbl8_alloc;
+
+			/* Group must be filled before it becomes visible */
+			asm volatile("" ::: "memory");
+			entry = DIR24_ENTRY_GROUP | ret;
+			table->tbl24[index24] = entry;
+		}
+
+		group = &table->tbl8[dir24_entry_index(entry) << 8];
+		range = 1 << (32 - prefix_len);
+
+		for(j = 0; j < range; j++){
+			if(dir24_entry_depth(group[(addr & 0xff) + j])
+			<= prefix_len)
+				group[(addr & 0xff) + j] = new;
+		}
+	}
+
+	return 0;
+
+err_tbl8_alloc:
+	return -1;
+}
+
+void dir24_delete(struct dir24_table *table, void *prefix,
+	unsigned int prefix_len, uint32_t index,
+	uint32_t index_new, unsigned int prefix_len_new)
+{
+	uint32_t addr, entry, old, new, *group;
+	unsigned int index24, range, i, j;
+
+	addr = ntohl(*(uint32_t *)prefix) & dir24_mask(prefix_len);
+	old = dir24_entry(index, prefix_len);
+	new = index_new ? dir24_entry(index_new, prefix_len_new) : 0;
+	index24 = addr >> 8;
+
+	/*
+	 * Only entries installed by the deleted route are replaced,
+	 * more specific routes remain untouched.
+	 */
+	if(prefix_len <= 24){
+		range = 1 << (24 - prefix_len);
+
+		for(i = 0; i < range; i++){
+			entry = table->tbl24[index24 + i];
+
+			if(!(entry & DIR24_ENTRY_GROUP)){
+				if(entry == old)
+					table->tbl24[index24 + i] = new;
+				continue;
+			}
+
+			group = &table->tbl8[dir24_entry_index(entry) << 8];
+			for(j = 0; j < DIR24_TBL8_SIZE; j++){
+				if(group[j] == old)
+					group[j] = new;
+			}
+
+			dir24_tbl8_collapse(table, index24 + i);
+		}
+	}else{
+		entry = table->tbl24[index24];
+		if(!(entry & DIR24_ENTRY_GROUP))
+			goto out;
+
+		group = &table->tbl8[dir24_entry_index(entry) << 8];
+		range = 1 << (32 - prefix_len);
+
+		for(j = 0; j < range; j++){
+			if(group[(addr & 0xff) + j] == old)
+				group[(addr & 0xff) + j] = new;
+		}
+
+		dir24_tbl8_collapse(table, index24);
+	}
+
+out:
+	return;
+}
+
+static void dir24_tbl8_collapse(struct dir24_table *table,
+	unsigned int index24)
+{
+	uint32_t entry, *group;
+	int i;
+
+	entry = table->tbl24[index24];
+	group = &table->tbl8[dir24_entry_index(entry) << 8];
+
+	/* The group is redundant when no route longer than /24 remains */
+	for(i = 0; i < DIR24_TBL8_SIZE; i++){
+		if(group[i] != group[0]
+		|| dir24_entry_depth(group[i]) > 24)
+			goto out;
+	}
+
+	table->tbl24[index24] = group[0];
+	dir24_tbl8_release(table, dir24_entry_index(entry));
+
+out:
+	return;
+}
+
+void dir24_lookup_bulk(struct dir24_table *table, void **dst,
+	uint32_t *index, int num)
+{
+	uint32_t addr;
+	int i;
+
+	/* Every stage prefetches for the whole burst before it is consumed */
+	for(i = 0; i < num; i++){
+		addr = ntohl(*(uint32_t *)dst[i]);
+		prefetch(&table->tbl24[addr >> 8]);
+	}
+
+	for(i = 0; i < num; i++){
+		addr = ntohl(*(uint32_t *)dst[i]);
+		index[i] = table->tbl24[addr >> 8];
+
+		if(unlikely(index[i] & DIR24_ENTRY_GROUP)){
+			prefetch(&table->tbl8[(dir24_entry_index(index[i]) << 8)
+				| (addr & 0xff)]);
+		}
+	}
+
+	for(i = 0; i < num; i++){
+		if(unlikely(index[i] & DIR24_ENTRY_GROUP)){
+			addr = ntohl(*(uint32_t *)dst[i]);
+			index[i] = table->tbl8[(dir24_entry_index(index[i]) << 8)
+				| (addr & 0xff)];
+		}
+
+		index[i] = dir24_entry_index(index[i]);
+	}
+
+	return;
+}
@@ -0,0 +1,67 @@
+#ifndef _UFPD_DIR24_H
+#define _UFPD_DIR24_H
+
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <ufp.h>
+#include "main.h"
+#include "rcu.h"
+
+#define DIR24_TBL24_SIZE	(1 << 24)
+#define DIR24_TBL8_SIZE		(1 << 8)
+#define DIR24_TBL8_GROUPS	(1 << 14)
+
+/*
+ * Each table entry is 32bit wide:
+ * bit 31	: entry points to a tbl8 group instead of a next hop
+ * bit 29-24	: prefix length which installed the entry
+ * bit 23-0	: next hop index (0 means no route) or tbl8 group index
+ */
+#define DIR24_ENTRY_GROUP	0x80000000
+#define DIR24_DEPTH_SHIFT	24
+#define DIR24_DEPTH_MASK	0x3f
+#define DIR24_INDEX_MASK	0x00ffffff
+#define DIR24_INDEX_MAX		DIR24_INDEX_MASK
+
+#define dir24_entry(index, depth) \
+	((uint32_t)(index) | ((uint32_t)(depth) << DIR24_DEPTH_SHIFT))
+#define dir24_entry_depth(entry) \
+	(((entry) >> DIR24_DEPTH_SHIFT) & DIR24_DEPTH_MASK)
+#define dir24_entry_index(entry) \
+	((entry) & DIR24_INDEX_MASK)
+
+struct dir24_table {
+	uint32_t		*tbl24;
+	uint32_t		*tbl8;
+	uint32_t		*tbl8_free;
+	unsigned int		tbl8_free_count;
+	struct rcu		*rcu;
+};
+
+struct dir24_table *dir24_alloc(struct ufp_mpool *mpool, struct rcu *rcu);
+void dir24_release(struct dir24_table *table);
+int dir24_add(struct dir24_table *table, void *prefix,
+	unsigned int prefix_len, uint32_t index);
+void dir24_delete(struct dir24_table *table, void *prefix,
+	unsigned int prefix_len, uint32_t index,
+	uint32_t index_new, unsigned int prefix_len_new);
+void dir24_lookup_bulk(struct dir24_table *table, void **dst,
+	uint32_t *index, int num);
+
+static inline uint32_t dir24_lookup(struct dir24_table *table,
+	void *dst)
+{
+	uint32_t addr, entry;
+
+	addr = ntohl(*(uint32_t *)dst);
+	entry = table->tbl24[addr >> 8];
+
+	if(unlikely(entry & DIR24_ENTRY_GROUP)){
+		entry = table->tbl8[(dir24_entry_index(entry) << 8)
+			| (addr & 0xff)];
+	}
+
+	return dir24_entry_index(entry);
+}
+
+#endif /* _UFPD_DIR24_H */
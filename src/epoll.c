@@ -173,3 +173,27 @@ void epoll_desc_release_netlink(struct epoll_desc *ep_desc)
 	free(ep_desc);
 	return;
 }
+
+struct epoll_desc *epoll_desc_alloc_control(struct control_ring *ring)
+{
+	struct epoll_desc *ep_desc;
+
+	ep_desc = malloc(sizeof(struct epoll_desc));
+	if(!ep_desc)
+		goto err_alloc_ep_desc;
+
+	ep_desc->fd		= ring->efd;
+	ep_desc->type		= EPOLL_CONTROL;
+	ep_desc->data		= ring;
+
+	return ep_desc;
+
+err_alloc_ep_desc:
+	return NULL;
+}
+
+void epoll_desc_release_control(struct epoll_desc *ep_desc)
+{
+	free(ep_desc);
+	return;
+}
@@ -4,6 +4,7 @@
 #include <linux/netlink.h>
 #include <signal.h>
 #include <ufp.h>
+#include "control.h"
 
 #define EPOLL_MAXEVENTS 16
 
@@ -12,7 +13,8 @@ enum {
 	EPOLL_IRQ_TX,
 	EPOLL_TUN,
 	EPOLL_SIGNAL,
-	EPOLL_NETLINK
+	EPOLL_NETLINK,
+	EPOLL_CONTROL
 };
 
 struct epoll_desc {
@@ -35,5 +37,7 @@ struct epoll_desc *epoll_desc_alloc_tun(struct ufp_plane *plane,
 void epoll_desc_release_tun(struct epoll_desc *ep_desc);
 struct epoll_desc *epoll_desc_alloc_netlink(struct sockaddr_nl *addr);
 void epoll_desc_release_netlink(struct epoll_desc *ep_desc);
+struct epoll_desc *epoll_desc_alloc_control(struct control_ring *ring);
+void epoll_desc_release_control(struct epoll_desc *ep_desc);
 
 #endif /* _UFPD_EPOLL_H */
@@ -4,7 +4,9 @@
 #include <stdint.h>
 #include <netinet/ip.h>
 #include <arpa/inet.h>
+#include <net/ethernet.h>
 #include <stddef.h>
+#include <syslog.h>
 #include <ufp.h>
 
 #include "main.h"
@@ -15,6 +17,38 @@ static int fib_entry_identify(void *ptr, unsigned int id,
 static int fib_entry_compare(void *ptr, unsigned int prefix_len);
 static void fib_entry_pull(void *ptr);
 static void fib_entry_put(void *ptr);
+static int fib_entry_index_alloc(struct fib *fib,
+	struct fib_entry *entry);
+static void fib_entry_index_release(struct fib *fib,
+	struct fib_entry *entry);
+static void fib_entry_index_reclaim(void *arg, void *ptr);
+static void fib_entry_nexthop_put(struct fib_entry *entry);
+static struct fib_entry *fib_entry_find(struct fib *fib,
+	void *prefix, unsigned int prefix_len, int id, int replace);
+static void fib_entry_replace(struct fib *fib,
+	struct fib_entry *entry_old, struct fib_entry *entry);
+static void fib_entry_replace_reclaim(void *arg, void *ptr);
+static struct fib_nexthop_group *fib_nexthop_group_alloc(struct fib *fib,
+	struct fib_nexthop *nexthops, unsigned int num_nexthops);
+static void fib_adj_key_build(struct fib *fib, struct fib_adj_key *key,
+	void *addr, int port_index);
+static struct fib_adj *fib_adj_lookup(struct fib *fib,
+	void *addr, int port_index);
+static struct fib_adj *fib_adj_get(struct fib *fib,
+	void *addr, int port_index);
+static void fib_adj_put(struct fib_adj *adj);
+static void fib_adj_delete(struct hash_entry *entry);
+static unsigned int fib_adj_key_generate(void *key,
+	unsigned int bit_len);
+static int fib_adj_key_compare(void *key_tgt, void *key_ent);
+static int fib_entry_insert_inet(struct fib *fib,
+	struct fib_entry *entry);
+static int fib_entry_insert_inet6(struct fib *fib,
+	struct fib_entry *entry);
+static struct fib_entry *fib_entry_remove_inet(struct fib *fib,
+	void *prefix, unsigned int prefix_len, int id);
+static struct fib_entry *fib_entry_remove_inet6(struct fib *fib,
+	void *prefix, unsigned int prefix_len, int id);
 
 #ifdef DEBUG
 static void fib_update_print(int family, enum fib_type type,
@@ -106,52 +140,175 @@ static void fib_delete_print(int family, void *prefix,
 }
 #endif
 
-struct fib *fib_alloc(struct ufp_mpool *mpool)
+struct fib *fib_alloc(struct ufp_mpool *mpool, int family,
+	struct rcu *rcu)
 {
         struct fib *fib;
+	int i;
 
 	fib = ufp_mem_alloc(mpool, sizeof(struct fib));
 	if(!fib)
 		goto err_fib_alloc;
 
-	lpm_init(&fib->table);
+	fib->family = family;
+	fib->rcu = rcu;
 
-	fib->table.entry_identify	= fib_entry_identify;
-	fib->table.entry_compare	= fib_entry_compare;
-	fib->table.entry_pull		= fib_entry_pull;
-	fib->table.entry_put		= fib_entry_put;
+	fib->entries = ufp_mem_alloc(mpool,
+		sizeof(struct fib_entry *) * FIB_MAX_ENTRIES);
+	if(!fib->entries)
+		goto err_entries_alloc;
+
+	fib->entries_free = ufp_mem_alloc(mpool,
+		sizeof(uint32_t) * FIB_MAX_ENTRIES);
+	if(!fib->entries_free)
+		goto err_entries_free_alloc;
+
+	fib->adjs = ufp_mem_alloc(mpool, sizeof(struct hash_table));
+	if(!fib->adjs)
+		goto err_adjs_alloc;
+
+	fib->entry_cache = ufp_mcache_alloc(mpool, sizeof(struct fib_entry));
+	if(!fib->entry_cache)
+		goto err_entry_cache;
+
+	fib->group_cache = ufp_mcache_alloc(mpool,
+		sizeof(struct fib_nexthop_group));
+	if(!fib->group_cache)
+		goto err_group_cache;
+
+	fib->adj_cache = ufp_mcache_alloc(mpool, sizeof(struct fib_adj));
+	if(!fib->adj_cache)
+		goto err_adj_cache;
+
+	hash_init(fib->adjs);
+	fib->adjs->hash_entry_delete	= fib_adj_delete;
+	fib->adjs->hash_key_generate	= fib_adj_key_generate;
+	fib->adjs->hash_key_compare	= fib_adj_key_compare;
+
+	for(i = 0; i < FIB_MAX_ENTRIES; i++){
+		fib->entries[i] = NULL;
+	}
+
+	/* Index 0 is never assigned so that it can be used as "no route" */
+	fib->entries_free_count = 0;
+	for(i = FIB_MAX_ENTRIES - 1; i > 0; i--){
+		fib->entries_free[fib->entries_free_count++] = i;
+	}
+
+	fib->table = NULL;
+	fib->dir24 = NULL;
+	fib->tbm = NULL;
+
+	switch(family){
+	case AF_INET:
+		fib->table = ufp_mem_alloc(mpool, sizeof(struct lpm_table));
+		if(!fib->table)
+			goto err_table_alloc;
+
+		if(lpm_init(fib->table, mpool) < 0)
+			goto err_lpm_init;
+
+		fib->table->entry_identify	= fib_entry_identify;
+		fib->table->entry_compare	= fib_entry_compare;
+		fib->table->entry_pull		= fib_entry_pull;
+		fib->table->entry_put		= fib_entry_put;
+
+		fib->dir24 = dir24_alloc(mpool, rcu);
+		if(!fib->dir24)
+			goto err_dir24_alloc;
+		break;
+	case AF_INET6:
+		fib->tbm = tbm_alloc(mpool, rcu);
+		if(!fib->tbm)
+			goto err_tbm_alloc;
+		break;
+	default:
+		goto err_invalid_family;
+		break;
+	}
 
 	return fib;
 
+err_dir24_alloc:
+	lpm_destroy(fib->table);
+err_lpm_init:
+	ufp_mem_free(fib->table);
+err_table_alloc:
+err_tbm_alloc:
+err_invalid_family:
+	ufp_mcache_release(fib->adj_cache);
+err_adj_cache:
+	ufp_mcache_release(fib->group_cache);
+err_group_cache:
+	ufp_mcache_release(fib->entry_cache);
+err_entry_cache:
+	ufp_mem_free(fib->adjs);
+err_adjs_alloc:
+	ufp_mem_free(fib->entries_free);
+err_entries_free_alloc:
+	ufp_mem_free(fib->entries);
+err_entries_alloc:
+	ufp_mem_free(fib);
 err_fib_alloc:
 	return NULL;
 }
 
 void fib_release(struct fib *fib)
 {
-	lpm_delete_all(&fib->table);
+	int i;
+
+	switch(fib->family){
+	case AF_INET:
+		lpm_delete_all(fib->table);
+		dir24_release(fib->dir24);
+		lpm_destroy(fib->table);
+		ufp_mem_free(fib->table);
+		break;
+	case AF_INET6:
+		tbm_release(fib->tbm);
+		break;
+	default:
+		break;
+	}
+
+	for(i = 0; i < FIB_MAX_ENTRIES; i++){
+		if(fib->entries[i])
+			fib_entry_put(fib->entries[i]);
+	}
+
+	/* Adjacencies only held by resolved neighbors remain */
+	hash_delete_all(fib->adjs);
+	ufp_mem_free(fib->adjs);
+
+	ufp_mcache_release(fib->adj_cache);
+	ufp_mcache_release(fib->group_cache);
+	ufp_mcache_release(fib->entry_cache);
+
+	ufp_mem_free(fib->entries_free);
+	ufp_mem_free(fib->entries);
 	ufp_mem_free(fib);
 	return;
 }
 
 int fib_route_update(struct fib *fib, int family, enum fib_type type,
-	void *prefix, unsigned int prefix_len, void *nexthop,
-	int port_index, int id, struct ufp_mpool *mpool)
+	void *prefix, unsigned int prefix_len,
+	struct fib_nexthop *nexthops, unsigned int num_nexthops,
+	int id, int replace)
 {
-	struct fib_entry *entry;
+	struct fib_entry *entry, *entry_old;
 	int ret;
 
-	entry = ufp_mem_alloc(mpool, sizeof(struct fib_entry));
+	entry = ufp_mcache_get(fib->entry_cache);
 	if(!entry)
 		goto err_alloc_entry;
 
 	switch(family){
 	case AF_INET:
-		memcpy(entry->nexthop, nexthop, 4);
+		memcpy(entry->nexthop, nexthops[0].addr, 4);
 		memcpy(entry->prefix, prefix, 4);
 		break;
 	case AF_INET6:
-		memcpy(entry->nexthop, nexthop, 16);
+		memcpy(entry->nexthop, nexthops[0].addr, 16);
 		memcpy(entry->prefix, prefix, 16);
 		break;
 	default:
@@ -160,26 +317,65 @@ int fib_route_update(struct fib *fib, int family, enum fib_type type,
 	}
 
 	entry->prefix_len	= prefix_len;
-	entry->port_index	= port_index;
+	entry->port_index	= nexthops[0].port_index;
 	entry->type		= type;
 	entry->id		= id;
 	entry->refcount		= 0;
+	entry->next		= NULL;
+	entry->adj		= NULL;
+	entry->group		= NULL;
+	entry->fib		= fib;
 
 #ifdef DEBUG
 	fib_update_print(family, type, prefix, prefix_len,
-		nexthop, port_index, id);
+		nexthops[0].addr, nexthops[0].port_index, id);
 #endif
 
-	ret = lpm_add(&fib->table, prefix, prefix_len,
-		id, entry, mpool);
+	if(type == FIB_TYPE_FORWARD){
+		if(num_nexthops > 1){
+			entry->group = fib_nexthop_group_alloc(fib,
+				nexthops, num_nexthops);
+			if(!entry->group)
+				goto err_nexthop_get;
+		}else{
+			entry->adj = fib_adj_get(fib, nexthops[0].addr,
+				nexthops[0].port_index);
+			if(!entry->adj)
+				goto err_nexthop_get;
+		}
+	}
+
+	/* Update of an existing route, e.g. changed multipath group */
+	entry_old = fib_entry_find(fib, prefix, prefix_len, id, replace);
+	if(entry_old){
+		fib_entry_replace(fib, entry_old, entry);
+		return 0;
+	}
+
+	ret = fib_entry_index_alloc(fib, entry);
 	if(ret < 0)
-		goto err_lpm_add;
+		goto err_index_alloc;
+
+	if(family == AF_INET)
+		ret = fib_entry_insert_inet(fib, entry);
+	else
+		ret = fib_entry_insert_inet6(fib, entry);
+
+	if(ret < 0)
+		goto err_insert;
 
 	return 0;
 
-err_lpm_add:
+err_insert:
+	/* entry is freed with the last reference */
+	fib_entry_index_release(fib, entry);
+	return -1;
+
+err_index_alloc:
+	fib_entry_nexthop_put(entry);
+err_nexthop_get:
 err_invalid_family:
-	ufp_mem_free(entry);
+	ufp_mcache_put(fib->entry_cache, entry);
 err_alloc_entry:
 	return -1;
 }
@@ -188,36 +384,567 @@ int fib_route_delete(struct fib *fib, int family,
 	void *prefix, unsigned int prefix_len,
 	int id)
 {
-	int ret;
+	struct fib_entry *entry;
 
 #ifdef DEBUG
 	fib_delete_print(family, prefix, prefix_len, id);
 #endif
 
-	ret = lpm_delete(&fib->table, prefix, prefix_len, id);
-	if(ret < 0)
-		goto err_lpm_delete;
+	switch(family){
+	case AF_INET:
+		entry = fib_entry_remove_inet(fib, prefix, prefix_len, id);
+		break;
+	case AF_INET6:
+		entry = fib_entry_remove_inet6(fib, prefix, prefix_len, id);
+		break;
+	default:
+		entry = NULL;
+		break;
+	}
 
+	if(!entry)
+		goto err_remove;
+
+	fib_entry_index_release(fib, entry);
 	return 0;
 
-err_lpm_delete:
+err_remove:
 	return -1;
 }
 
 struct fib_entry *fib_lookup(struct fib *fib, void *destination)
 {
-	struct lpm_entry *entry;
+	uint32_t index;
+
+	switch(fib->family){
+	case AF_INET:
+		index = dir24_lookup(fib->dir24, destination);
+		break;
+	case AF_INET6:
+		index = tbm_lookup(fib->tbm, destination);
+		break;
+	default:
+		index = 0;
+		break;
+	}
+
+	return fib->entries[index];
+}
+
+void fib_lookup_bulk(struct fib *fib, void **destination,
+	struct fib_entry **entry, int num)
+{
+	uint32_t index[FIB_LOOKUP_BULK];
+	int base, n, i;
+
+	for(base = 0; base < num; base += FIB_LOOKUP_BULK){
+		n = min(num - base, FIB_LOOKUP_BULK);
+
+		switch(fib->family){
+		case AF_INET:
+			dir24_lookup_bulk(fib->dir24, &destination[base],
+				index, n);
+			break;
+		case AF_INET6:
+			tbm_lookup_bulk(fib->tbm, &destination[base],
+				index, n);
+			break;
+		default:
+			memset(index, 0, sizeof(uint32_t) * n);
+			break;
+		}
+
+		for(i = 0; i < n; i++){
+			prefetch(&fib->entries[index[i]]);
+		}
+
+		/* Entries are consumed by the next stage of the caller */
+		for(i = 0; i < n; i++){
+			entry[base + i] = fib->entries[index[i]];
+			if(entry[base + i])
+				prefetch(entry[base + i]);
+		}
+	}
+
+	return;
+}
+
+static int fib_entry_insert_inet(struct fib *fib,
+	struct fib_entry *entry)
+{
+	int ret;
+
+	ret = lpm_add(fib->table, entry->prefix, entry->prefix_len,
+		entry->id, entry);
+	if(ret < 0)
+		goto err_lpm_add;
+
+	ret = dir24_add(fib->dir24, entry->prefix, entry->prefix_len,
+		entry->index);
+	if(ret < 0)
+		goto err_dir24_add;
+
+	return 0;
+
+err_dir24_add:
+	lpm_delete(fib->table, entry->prefix, entry->prefix_len, entry->id);
+err_lpm_add:
+	return -1;
+}
+
+static int fib_entry_insert_inet6(struct fib *fib,
+	struct fib_entry *entry)
+{
+	struct fib_entry *head, *cur;
+	int ret;
+
+	head = fib->entries[tbm_find(fib->tbm,
+		entry->prefix, entry->prefix_len)];
+
+	for(cur = head; cur; cur = cur->next){
+		if(cur->id == entry->id)
+			goto err_entry_exist;
+	}
+
+	/* The latest route takes precedence as lpm does */
+	entry->next = head;
+
+	ret = tbm_add(fib->tbm, entry->prefix, entry->prefix_len,
+		entry->index);
+	if(ret < 0)
+		goto err_tbm_add;
+
+	return 0;
+
+err_tbm_add:
+err_entry_exist:
+	return -1;
+}
+
+static struct fib_entry *fib_entry_remove_inet(struct fib *fib,
+	void *prefix, unsigned int prefix_len, int id)
+{
+	struct lpm_entry *lpm_entry;
+	struct fib_entry *entry, *entry_new;
+	int ret;
+
+	lpm_entry = lpm_find(fib->table, prefix, prefix_len, id);
+	if(!lpm_entry)
+		goto err_lpm_find;
+
+	entry = lpm_entry->ptr;
+
+	ret = lpm_delete(fib->table, prefix, prefix_len, id);
+	if(ret < 0)
+		goto err_lpm_delete;
+
+	/* Fall back to the best route which covers deleted one */
+	lpm_entry = lpm_lookup_prefix(fib->table, prefix, prefix_len);
+	if(lpm_entry){
+		entry_new = lpm_entry->ptr;
+		dir24_delete(fib->dir24, prefix, prefix_len,
+			entry->index, entry_new->index,
+			entry_new->prefix_len);
+	}else{
+		dir24_delete(fib->dir24, prefix, prefix_len,
+			entry->index, 0, 0);
+	}
+
+	return entry;
+
+err_lpm_delete:
+err_lpm_find:
+	return NULL;
+}
+
+static struct fib_entry *fib_entry_remove_inet6(struct fib *fib,
+	void *prefix, unsigned int prefix_len, int id)
+{
+	struct fib_entry *entry, *prev;
+	int ret;
+
+	prev = NULL;
+	entry = fib->entries[tbm_find(fib->tbm, prefix, prefix_len)];
+
+	for(; entry; prev = entry, entry = entry->next){
+		if(entry->id == id)
+			break;
+	}
 
-	entry = lpm_lookup(&fib->table, destination);
 	if(!entry)
-		goto err_lpm_lookup;
+		goto err_not_found;
 
-	return entry->ptr;
+	if(prev){
+		prev->next = entry->next;
+	}else if(entry->next){
+		/* Shadowed route becomes active, replacing never fails */
+		tbm_add(fib->tbm, prefix, prefix_len, entry->next->index);
+	}else{
+		ret = tbm_delete(fib->tbm, prefix, prefix_len);
+		if(ret < 0)
+			goto err_tbm_delete;
+	}
 
-err_lpm_lookup:
+	return entry;
+
+err_tbm_delete:
+err_not_found:
 	return NULL;
 }
 
+static struct fib_entry *fib_entry_find(struct fib *fib,
+	void *prefix, unsigned int prefix_len, int id, int replace)
+{
+	struct lpm_entry *lpm_entry;
+	struct fib_entry *entry, *head;
+
+	switch(fib->family){
+	case AF_INET:
+		lpm_entry = lpm_find(fib->table, prefix, prefix_len, id);
+
+		/* NLM_F_REPLACE takes over the route of any id */
+		if(!lpm_entry && replace){
+			lpm_entry = lpm_lookup_prefix(fib->table,
+				prefix, prefix_len);
+			if(lpm_entry && ((struct fib_entry *)lpm_entry->ptr)
+			->prefix_len != prefix_len)
+				lpm_entry = NULL;
+		}
+
+		entry = lpm_entry ? lpm_entry->ptr : NULL;
+		break;
+	case AF_INET6:
+		head = fib->entries[tbm_find(fib->tbm, prefix, prefix_len)];
+
+		for(entry = head; entry; entry = entry->next){
+			if(entry->id == id)
+				break;
+		}
+
+		if(!entry && replace)
+			entry = head;
+		break;
+	default:
+		entry = NULL;
+		break;
+	}
+
+	return entry;
+}
+
+static void fib_entry_replace(struct fib *fib,
+	struct fib_entry *entry_old, struct fib_entry *entry)
+{
+	struct fib_entry *cur;
+
+	/* Index is taken over, so that lookup tables stay untouched */
+	entry->index = entry_old->index;
+	fib_entry_pull(entry);
+
+	switch(fib->family){
+	case AF_INET:
+		/* Every expanded node of the route moves to the new entry */
+		lpm_replace(fib->table, entry_old->prefix,
+			entry_old->prefix_len, entry_old->id, entry);
+		break;
+	case AF_INET6:
+		entry->next = entry_old->next;
+
+		cur = fib->entries[tbm_find(fib->tbm,
+			entry->prefix, entry->prefix_len)];
+		for(; cur; cur = cur->next){
+			if(cur->next == entry_old){
+				cur->next = entry;
+				break;
+			}
+		}
+		break;
+	default:
+		break;
+	}
+
+	fib->entries[entry->index] = entry;
+
+	/* Old nexthops are released after readers leave the entry */
+	rcu_defer(fib->rcu, fib_entry_replace_reclaim, fib, entry_old);
+	return;
+}
+
+static void fib_entry_replace_reclaim(void *arg, void *ptr)
+{
+	fib_entry_put(ptr);
+	return;
+}
+
+static int fib_entry_index_alloc(struct fib *fib,
+	struct fib_entry *entry)
+{
+	if(!fib->entries_free_count)
+		goto err_no_index;
+
+	entry->index = fib->entries_free[--fib->entries_free_count];
+	fib->entries[entry->index] = entry;
+
+	/* The index table holds its own reference */
+	fib_entry_pull(entry);
+	return 0;
+
+err_no_index:
+	return -1;
+}
+
+static void fib_entry_index_release(struct fib *fib,
+	struct fib_entry *entry)
+{
+	fib->entries[entry->index] = NULL;
+
+	/* Readers may still hold the index until grace period */
+	rcu_defer(fib->rcu, fib_entry_index_reclaim, fib, entry);
+	return;
+}
+
+static void fib_entry_index_reclaim(void *arg, void *ptr)
+{
+	struct fib *fib;
+	struct fib_entry *entry;
+
+	fib = arg;
+	entry = ptr;
+
+	fib->entries_free[fib->entries_free_count++] = entry->index;
+	fib_entry_put(entry);
+	return;
+}
+
+static struct fib_nexthop_group *fib_nexthop_group_alloc(struct fib *fib,
+	struct fib_nexthop *nexthops, unsigned int num_nexthops)
+{
+	struct fib_nexthop_group *group;
+	unsigned int weight_total, weight_sum;
+	int i, j;
+
+	group = ufp_mcache_get(fib->group_cache);
+	if(!group)
+		goto err_group_alloc;
+
+	if(num_nexthops > FIB_MULTIPATH_MAX){
+		ufpd_log(LOG_WARNING,
+			"nexthop group limited to %d of %u members",
+			FIB_MULTIPATH_MAX, num_nexthops);
+	}
+
+	group->num_nexthops = min(num_nexthops,
+		(unsigned int)FIB_MULTIPATH_MAX);
+	memcpy(group->nexthops, nexthops,
+		sizeof(struct fib_nexthop) * group->num_nexthops);
+
+	for(i = 0; i < group->num_nexthops; i++){
+		group->adjs[i] = fib_adj_get(fib, nexthops[i].addr,
+			nexthops[i].port_index);
+		if(!group->adjs[i])
+			goto err_adj_get;
+	}
+
+	weight_total = 0;
+	for(i = 0; i < group->num_nexthops; i++){
+		weight_total += group->nexthops[i].weight;
+	}
+
+	/* Member i covers buckets until cumulative weight of 0..i */
+	weight_sum = group->nexthops[0].weight;
+	for(i = 0, j = 0; i < FIB_MULTIPATH_BUCKETS; i++){
+		while(i * weight_total >= weight_sum * FIB_MULTIPATH_BUCKETS
+		&& j < group->num_nexthops - 1){
+			weight_sum += group->nexthops[++j].weight;
+		}
+		group->buckets[i] = j;
+	}
+
+	return group;
+
+err_adj_get:
+	while(--i >= 0){
+		fib_adj_put(group->adjs[i]);
+	}
+	ufp_mcache_put(fib->group_cache, group);
+err_group_alloc:
+	return NULL;
+}
+
+static void fib_entry_nexthop_put(struct fib_entry *entry)
+{
+	int i;
+
+	if(entry->adj)
+		fib_adj_put(entry->adj);
+
+	if(entry->group){
+		for(i = 0; i < entry->group->num_nexthops; i++){
+			fib_adj_put(entry->group->adjs[i]);
+		}
+		ufp_mcache_put(entry->fib->group_cache, entry->group);
+	}
+
+	return;
+}
+
+int fib_neigh_update(struct fib *fib, void *dst_addr, int port_index,
+	void *dst_mac, void *src_mac)
+{
+	struct fib_adj *adj;
+	struct ethhdr *eth;
+	union {
+		uint8_t		eth[16];
+		uint64_t	eth_word[2];
+	} hdr;
+
+	adj = fib_adj_lookup(fib, dst_addr, port_index);
+	if(!adj){
+		adj = fib_adj_get(fib, dst_addr, port_index);
+		if(!adj)
+			goto err_adj_get;
+	}else if(!adj->resolved){
+		adj->refcount++;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	eth = (struct ethhdr *)hdr.eth;
+	memcpy(eth->h_dest, dst_mac, ETH_ALEN);
+	memcpy(eth->h_source, src_mac, ETH_ALEN);
+	eth->h_proto = htons(fib->family == AF_INET ?
+		ETH_P_IP : ETH_P_IPV6);
+
+	/* Readers may copy the header meanwhile, the MAC is in one word */
+	adj->eth_word[1] = hdr.eth_word[1];
+	*(volatile uint64_t *)&adj->eth_word[0] = hdr.eth_word[0];
+
+	asm volatile("" ::: "memory");
+	adj->resolved = 1;
+	return 0;
+
+err_adj_get:
+	return -1;
+}
+
+int fib_neigh_delete(struct fib *fib, void *dst_addr, int port_index)
+{
+	struct fib_adj *adj;
+
+	adj = fib_adj_lookup(fib, dst_addr, port_index);
+	if(!adj || !adj->resolved)
+		goto err_not_found;
+
+	/* Routes keep it to be resolved again */
+	adj->resolved = 0;
+	fib_adj_put(adj);
+	return 0;
+
+err_not_found:
+	return -1;
+}
+
+static void fib_adj_key_build(struct fib *fib, struct fib_adj_key *key,
+	void *addr, int port_index)
+{
+	memset(key, 0, sizeof(struct fib_adj_key));
+	memcpy(key->addr, addr, fib->family == AF_INET ? 4 : 16);
+	key->port_index = port_index;
+	return;
+}
+
+static struct fib_adj *fib_adj_lookup(struct fib *fib,
+	void *addr, int port_index)
+{
+	struct fib_adj_key key;
+	struct hash_entry *hash_entry;
+
+	fib_adj_key_build(fib, &key, addr, port_index);
+
+	hash_entry = hash_lookup(fib->adjs, &key);
+	if(!hash_entry)
+		goto err_hash_lookup;
+
+	return hash_entry(hash_entry, struct fib_adj, hash);
+
+err_hash_lookup:
+	return NULL;
+}
+
+static struct fib_adj *fib_adj_get(struct fib *fib,
+	void *addr, int port_index)
+{
+	struct fib_adj *adj;
+	int ret;
+
+	adj = fib_adj_lookup(fib, addr, port_index);
+	if(adj)
+		goto out;
+
+	adj = ufp_mcache_get(fib->adj_cache);
+	if(!adj)
+		goto err_adj_alloc;
+
+	memset(adj->eth, 0, sizeof(adj->eth));
+	adj->resolved	= 0;
+	adj->port_index	= port_index;
+	adj->refcount	= 0;
+	adj->fib	= fib;
+	fib_adj_key_build(fib, &adj->key, addr, port_index);
+
+	ret = hash_add(fib->adjs, &adj->key, &adj->hash);
+	if(ret < 0)
+		goto err_hash_add;
+
+out:
+	adj->refcount++;
+	return adj;
+
+err_hash_add:
+	ufp_mcache_put(fib->adj_cache, adj);
+err_adj_alloc:
+	return NULL;
+}
+
+static void fib_adj_put(struct fib_adj *adj)
+{
+	adj->refcount--;
+
+	/* Readers reach it only through entries, already unreachable */
+	if(!adj->refcount)
+		hash_delete(adj->fib->adjs, &adj->key);
+
+	return;
+}
+
+static void fib_adj_delete(struct hash_entry *entry)
+{
+	struct fib_adj *adj;
+
+	adj = hash_entry(entry, struct fib_adj, hash);
+	ufp_mcache_put(adj->fib->adj_cache, adj);
+	return;
+}
+
+static unsigned int fib_adj_key_generate(void *key, unsigned int bit_len)
+{
+	struct fib_adj_key *adj_key;
+	uint64_t hash;
+
+	adj_key = key;
+	hash = ((uint64_t)adj_key->addr[0] << 32 | adj_key->addr[1])
+		^ ((uint64_t)adj_key->addr[2] << 32 | adj_key->addr[3])
+		^ adj_key->port_index;
+	hash *= GOLDEN_RATIO_PRIME_64;
+
+	return hash >> (64 - bit_len);
+}
+
+static int fib_adj_key_compare(void *key_tgt, void *key_ent)
+{
+	return memcmp(key_tgt, key_ent, sizeof(struct fib_adj_key)) ?
+		1 : 0;
+}
+
 static int fib_entry_identify(void *ptr, unsigned int id,
 	unsigned int prefix_len)
 {
@@ -261,6 +988,7 @@ static void fib_entry_put(void *ptr)
 	entry->refcount--;
 
 	if(!entry->refcount){
-		ufp_mem_free(entry);
+		fib_entry_nexthop_put(entry);
+		ufp_mcache_put(entry->fib->entry_cache, entry);
 	}
 }
@@ -4,6 +4,16 @@
 #include <pthread.h>
 #include <ufp.h>
 #include "lpm.h"
+#include "dir24.h"
+#include "tbm.h"
+#include "rcu.h"
+#include "hash.h"
+
+/* Index 0 is reserved for "no route" */
+#define FIB_MAX_ENTRIES (1 << 20)
+#define FIB_LOOKUP_BULK 32
+#define FIB_MULTIPATH_MAX 8
+#define FIB_MULTIPATH_BUCKETS 256 /* must be power of 2 */
 
 enum fib_type {
 	FIB_TYPE_FORWARD = 0,
@@ -11,28 +21,94 @@ enum fib_type {
 	FIB_TYPE_LOCAL
 };
 
+struct fib_nexthop {
+	uint8_t			addr[16];
+	int			port_index; /* -1 means not ufp interface */
+	unsigned int		weight;
+};
+
+struct fib_adj_key {
+	uint32_t		addr[4];
+	int			port_index;
+};
+
+/*
+ * Adjacency: nexthop resolved in advance, shared by every route
+ * pointing the same neighbor. Neighbor updates rewrite it in place.
+ */
+struct fib_adj {
+	union {
+		uint8_t		eth[16]; /* dst MAC, src MAC, ethertype */
+		uint64_t	eth_word[2];
+	};
+	volatile int		resolved;
+	int			port_index;
+	unsigned int		refcount;
+	struct fib		*fib;
+	struct fib_adj_key	key;
+	struct hash_entry	hash;
+};
+
+/* Each bucket points a member, in proportion to its weight */
+struct fib_nexthop_group {
+	unsigned int		num_nexthops;
+	struct fib_nexthop	nexthops[FIB_MULTIPATH_MAX];
+	struct fib_adj		*adjs[FIB_MULTIPATH_MAX];
+	uint8_t			buckets[FIB_MULTIPATH_BUCKETS];
+};
+
 struct fib_entry {
 	uint8_t			prefix[16];
 	unsigned int		prefix_len;
 	uint8_t			nexthop[16];
 	int			port_index; /* -1 means not ufp interface */
+	struct fib_adj		*adj; /* FORWARD only */
+	struct fib_nexthop_group *group; /* NULL unless multipath */
 	enum fib_type		type;
 	int			id;
 	unsigned int		refcount;
+	uint32_t		index;
+	struct fib		*fib;
+	struct fib_entry	*next; /* AF_INET6: same prefix, shadowed */
 };
 
 struct fib {
-	struct lpm_table	table;
+	int			family;
+	struct lpm_table	*table;
+	struct dir24_table	*dir24;
+	struct tbm_table	*tbm;
+	struct fib_entry	**entries;
+	uint32_t		*entries_free;
+	unsigned int		entries_free_count;
+	struct hash_table	*adjs;
+	struct ufp_mcache	*entry_cache;
+	struct ufp_mcache	*group_cache;
+	struct ufp_mcache	*adj_cache;
+	struct rcu		*rcu; /* NULL when private to a thread */
 };
 
-struct fib *fib_alloc(struct ufp_mpool *mpool);
+struct fib *fib_alloc(struct ufp_mpool *mpool, int family,
+	struct rcu *rcu);
 void fib_release(struct fib *fib);
 int fib_route_update(struct fib *fib, int family, enum fib_type type,
-	void *prefix, unsigned int prefix_len, void *nexthop,
-	int port_index, int id, struct ufp_mpool *mpool);
+	void *prefix, unsigned int prefix_len,
+	struct fib_nexthop *nexthops, unsigned int num_nexthops,
+	int id, int replace);
 int fib_route_delete(struct fib *fib, int family,
 	void *prefix, unsigned int prefix_len,
 	int id);
+int fib_neigh_update(struct fib *fib, void *dst_addr, int port_index,
+	void *dst_mac, void *src_mac);
+int fib_neigh_delete(struct fib *fib, void *dst_addr, int port_index);
 struct fib_entry *fib_lookup(struct fib *fib, void *destination);
+void fib_lookup_bulk(struct fib *fib, void **destination,
+	struct fib_entry **entry, int num);
+
+static inline struct fib_adj *fib_nexthop_select(
+	struct fib_nexthop_group *group, uint32_t hash)
+{
+	return group->adjs[group->buckets[
+		hash & (FIB_MULTIPATH_BUCKETS - 1)]];
+}
 
 #endif /* _UFPD_FIB_H */
@@ -6,6 +6,10 @@
 #include <arpa/inet.h>
 #include <netinet/ip.h>
 #include <netinet/ip6.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <sys/uio.h>
+#include <linux/virtio_net.h>
 #include <stddef.h>
 #include <ufp.h>
 
@@ -13,12 +17,38 @@
 #include "forward.h"
 #include "thread.h"
 
+static void forward_process_bulk(struct ufpd_thread *thread,
+	unsigned int port_index, struct ufp_packet *packet, int num_packet);
+static void forward_route_process(struct ufpd_thread *thread,
+	unsigned int port_index, int family, struct ufp_packet **packet,
+	void **dst, int num_packet);
 static int forward_arp_process(struct ufpd_thread *thread,
 	unsigned int port_index, struct ufp_packet *packet);
-static int forward_ip_process(struct ufpd_thread *thread,
+static int forward_local_process(struct ufpd_thread *thread,
 	unsigned int port_index, struct ufp_packet *packet);
+static int forward_ip_process(struct ufpd_thread *thread,
+	unsigned int port_index, struct ufp_packet *packet,
+	struct fib_entry *fib_entry, struct fib_adj *adj,
+	struct neigh_entry *neigh_entry);
 static int forward_ip6_process(struct ufpd_thread *thread,
+	unsigned int port_index, struct ufp_packet *packet,
+	struct fib_entry *fib_entry, struct fib_adj *adj,
+	struct neigh_entry *neigh_entry);
+static inline int forward_l2_rewrite(struct ufpd_thread *thread,
+	struct ethhdr *eth, struct fib_entry *fib_entry,
+	struct fib_adj *adj, struct neigh_entry *neigh_entry);
+static int forward_tun_offload(struct ufp_packet *packet,
+	struct virtio_net_hdr *vnet_hdr);
+static void forward_tun_csum(struct ufp_packet *packet,
+	struct virtio_net_hdr *vnet_hdr);
+static int forward_tun_write(struct ufpd_thread *thread,
+	unsigned int port_index, struct ufp_packet *packet);
+static inline void forward_stage_add(struct ufpd_thread *thread,
 	unsigned int port_index, struct ufp_packet *packet);
+static void forward_stage_flush(struct ufpd_thread *thread);
+static inline uint32_t forward_hash_mix(uint32_t hash, uint32_t val);
+static inline uint32_t forward_flow_hash(int family,
+	struct ufp_packet *packet);
 
 #ifdef DEBUG
 void forward_dump(struct ufp_packet *packet)
@@ -42,8 +72,7 @@ void forward_dump(struct ufp_packet *packet)
 void forward_process(struct ufpd_thread *thread, unsigned int port_index,
 	struct ufp_packet *packet, int num_packet)
 {
-	struct ethhdr *eth;
-	int i, ret;
+	int i;
 
 	/* software prefetch is not needed when DDIO is available */
 #ifdef DDIO_UNSUPPORTED
@@ -52,6 +81,66 @@ void forward_process(struct ufpd_thread *thread, unsigned int port_index,
 	}
 #endif
 
+	for(i = 0; i < num_packet; i += FORWARD_BULK){
+		forward_process_bulk(thread, port_index, &packet[i],
+			min(num_packet - i, FORWARD_BULK));
+	}
+
+	forward_stage_flush(thread);
+	return;
+}
+
+static inline void forward_stage_add(struct ufpd_thread *thread,
+	unsigned int port_index, struct ufp_packet *packet)
+{
+	struct forward_stage *stage;
+
+	stage = &thread->tx_stage[port_index];
+	stage->packet[stage->num++] = packet;
+
+	if(unlikely(stage->num == FORWARD_STAGE)){
+		ufp_tx_assign_bulk(thread->plane, port_index, thread->buf,
+			stage->packet, stage->num);
+		stage->num = 0;
+	}
+
+	return;
+}
+
+static void forward_stage_flush(struct ufpd_thread *thread)
+{
+	struct forward_stage *stage;
+	int i;
+
+	for(i = 0; i < thread->num_ports; i++){
+		stage = &thread->tx_stage[i];
+		if(!stage->num)
+			continue;
+
+		ufp_tx_assign_bulk(thread->plane, i, thread->buf,
+			stage->packet, stage->num);
+		stage->num = 0;
+	}
+
+	return;
+}
+
+static void forward_process_bulk(struct ufpd_thread *thread,
+	unsigned int port_index, struct ufp_packet *packet, int num_packet)
+{
+	struct ufp_packet	*packet_inet[FORWARD_BULK];
+	struct ufp_packet	*packet_inet6[FORWARD_BULK];
+	void			*dst_inet[FORWARD_BULK];
+	void			*dst_inet6[FORWARD_BULK];
+	struct ethhdr		*eth;
+	struct iphdr		*ip;
+	struct ip6_hdr		*ip6;
+	int			num_inet, num_inet6, i;
+
+	num_inet = 0;
+	num_inet6 = 0;
+
+	/* Sort out routed packets, the others are done here */
 	for(i = 0; i < num_packet; i++){
 #ifdef DEBUG
 		forward_dump(&packet[i]);
@@ -65,30 +154,119 @@ void forward_process(struct ufpd_thread *thread, unsigned int port_index,
 		eth = (struct ethhdr *)packet[i].slot_buf;
 		switch(ntohs(eth->h_proto)){
 		case ETH_P_ARP:
-			ret = forward_arp_process(thread,
-				port_index, &packet[i]);
+			forward_arp_process(thread, port_index, &packet[i]);
 			break;
 		case ETH_P_IP:
-			ret = forward_ip_process(thread,
-				port_index, &packet[i]);
-			break;
+			ip = (struct iphdr *)(packet[i].slot_buf
+				+ sizeof(struct ethhdr));
+			packet_inet[num_inet] = &packet[i];
+			dst_inet[num_inet++] = &ip->daddr;
+			continue;
 		case ETH_P_IPV6:
-			ret = forward_ip6_process(thread,
-				port_index, &packet[i]);
+			ip6 = (struct ip6_hdr *)(packet[i].slot_buf
+				+ sizeof(struct ethhdr));
+			if(unlikely(IN6_IS_ADDR_LINKLOCAL(&ip6->ip6_dst))){
+				forward_local_process(thread,
+					port_index, &packet[i]);
+				break;
+			}
+			packet_inet6[num_inet6] = &packet[i];
+			dst_inet6[num_inet6++] = &ip6->ip6_dst;
+			continue;
+		default:
+			break;
+		}
+
+packet_drop:
+		ufp_slot_release(thread->buf, packet[i].slot_index);
+	}
+
+	forward_route_process(thread, port_index, AF_INET,
+		packet_inet, dst_inet, num_inet);
+	forward_route_process(thread, port_index, AF_INET6,
+		packet_inet6, dst_inet6, num_inet6);
+
+	return;
+}
+
+static void forward_route_process(struct ufpd_thread *thread,
+	unsigned int port_index, int family, struct ufp_packet **packet,
+	void **dst, int num_packet)
+{
+	struct fib		*fib;
+	struct neigh_table	**neigh_table;
+	struct fib_entry	*fib_entry[FORWARD_BULK];
+	struct fib_adj		*adj[FORWARD_BULK];
+	struct neigh_entry	*neigh_entry[FORWARD_BULK];
+	struct neigh_table	*neigh[FORWARD_BULK];
+	void			*neigh_key[FORWARD_BULK];
+	int			i, ret;
+
+	if(!num_packet)
+		return;
+
+	if(family == AF_INET){
+		fib = thread->fib_inet;
+		neigh_table = thread->neigh_inet;
+	}else{
+		fib = thread->fib_inet6;
+		neigh_table = thread->neigh_inet6;
+	}
+
+	fib_lookup_bulk(fib, dst, fib_entry, num_packet);
+
+	for(i = 0; i < num_packet; i++){
+		adj[i] = NULL;
+		neigh[i] = NULL;
+		neigh_key[i] = NULL;
+
+		if(!fib_entry[i])
+			continue;
+
+		switch(fib_entry[i]->type){
+		case FIB_TYPE_LINK:
+			if(unlikely(fib_entry[i]->port_index < 0))
+				break;
+
+			neigh[i] = neigh_table[fib_entry[i]->port_index];
+			neigh_key[i] = dst[i];
+			break;
+		case FIB_TYPE_FORWARD:
+			/* Nexthop is resolved in advance, no neighbor lookup */
+			if(fib_entry[i]->group){
+				/* Keep packets of a flow on the same path */
+				adj[i] = fib_nexthop_select(fib_entry[i]->group,
+					forward_flow_hash(family, packet[i]));
+			}else{
+				adj[i] = fib_entry[i]->adj;
+			}
+			prefetch(adj[i]);
 			break;
 		default:
-			ret = -1;
 			break;
 		}
+	}
 
-		if(ret < 0)
-			goto packet_drop;
+	neigh_lookup_bulk(neigh, neigh_key, neigh_entry, num_packet);
+
+	for(i = 0; i < num_packet; i++){
+		if(family == AF_INET){
+			ret = forward_ip_process(thread, port_index,
+				packet[i], fib_entry[i], adj[i],
+				neigh_entry[i]);
+		}else{
+			ret = forward_ip6_process(thread, port_index,
+				packet[i], fib_entry[i], adj[i],
+				neigh_entry[i]);
+		}
 
-		ufp_tx_assign(thread->plane, ret, thread->buf,
-			&packet[i]);
+		/* Slot is released by TX cleaning once transmitted */
+		if(ret < 0){
+			ufp_slot_release(thread->buf, packet[i]->slot_index);
+			continue;
+		}
 
-packet_drop:
-		ufp_slot_release(thread->buf, packet[i].slot_index);
+		forward_stage_add(thread, ret, packet[i]);
 	}
 
 	return;
@@ -98,6 +276,15 @@ void forward_process_tun(struct ufpd_thread *thread, unsigned int port_index,
 	uint8_t *read_buf, unsigned int read_size)
 {
 	struct ufp_packet packet;
+	struct virtio_net_hdr vnet_hdr;
+	int ret;
+
+	if(read_size < sizeof(struct virtio_net_hdr))
+		goto err_vnet_hdr;
+
+	memcpy(&vnet_hdr, read_buf, sizeof(struct virtio_net_hdr));
+	read_buf += sizeof(struct virtio_net_hdr);
+	read_size -= sizeof(struct virtio_net_hdr);
 
 	if(read_size > ufp_slot_size(thread->buf))
 		goto err_slot_size;
@@ -113,6 +300,13 @@ void forward_process_tun(struct ufpd_thread *thread, unsigned int port_index,
 	packet.slot_size = read_size;
 	packet.flag = UFP_PACKET_EOF;
 
+	/* Kernel left L4 checksum, NIC fills it if we can describe */
+	if(vnet_hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM){
+		ret = forward_tun_offload(&packet, &vnet_hdr);
+		if(ret < 0)
+			forward_tun_csum(&packet, &vnet_hdr);
+	}
+
 #ifdef DEBUG
 	forward_dump(&packet);
 #endif
@@ -122,16 +316,146 @@ void forward_process_tun(struct ufpd_thread *thread, unsigned int port_index,
 
 err_slot_assign:
 err_slot_size:
+err_vnet_hdr:
 	return;
 }
 
-static int forward_arp_process(struct ufpd_thread *thread,
+static int forward_tun_offload(struct ufp_packet *packet,
+	struct virtio_net_hdr *vnet_hdr)
+{
+	struct ethhdr		*eth;
+	struct tcphdr		*tcp;
+	uint16_t		proto;
+	unsigned int		l2_len;
+
+	/* Header offsets come from the kernel side, check everything */
+	if(packet->slot_size < sizeof(struct ethhdr) + 4)
+		goto err_l2_len;
+
+	eth = (struct ethhdr *)packet->slot_buf;
+	proto = eth->h_proto;
+	l2_len = sizeof(struct ethhdr);
+
+	if(proto == htons(ETH_P_8021Q)){
+		proto = *(uint16_t *)(packet->slot_buf + l2_len + 2);
+		l2_len += 4;
+	}
+
+	switch(ntohs(proto)){
+	case ETH_P_IP:
+		packet->flag |= UFP_PACKET_TX_IPV4;
+		break;
+	case ETH_P_IPV6:
+		packet->flag |= UFP_PACKET_TX_IPV6;
+		break;
+	default:
+		goto err_proto;
+	}
+
+	if(vnet_hdr->csum_start < l2_len)
+		goto err_csum_start;
+
+	packet->l2_len = l2_len;
+	packet->l3_len = vnet_hdr->csum_start - l2_len;
+
+	switch(vnet_hdr->csum_offset){
+	case offsetof(struct tcphdr, check):
+		if(vnet_hdr->csum_start + sizeof(struct tcphdr)
+		> packet->slot_size)
+			goto err_l4_len;
+
+		tcp = (struct tcphdr *)(packet->slot_buf
+			+ vnet_hdr->csum_start);
+		packet->flag |= UFP_PACKET_TX_TCP_CSUM;
+		packet->l4_len = tcp->doff << 2;
+		if(packet->l4_len < sizeof(struct tcphdr))
+			goto err_l4_len;
+		break;
+	case offsetof(struct udphdr, check):
+		packet->flag |= UFP_PACKET_TX_UDP_CSUM;
+		packet->l4_len = sizeof(struct udphdr);
+		break;
+	default:
+		goto err_csum_offset;
+	}
+
+	if(vnet_hdr->csum_start + packet->l4_len > packet->slot_size)
+		goto err_l4_len;
+
+	return 0;
+
+err_l4_len:
+err_csum_offset:
+err_csum_start:
+err_proto:
+err_l2_len:
+	packet->flag &= ~UFP_PACKET_TX_OFFLOAD;
+	return -1;
+}
+
+static void forward_tun_csum(struct ufp_packet *packet,
+	struct virtio_net_hdr *vnet_hdr)
+{
+	uint8_t			*data;
+	uint32_t		sum;
+	uint16_t		last, check;
+	unsigned int		len, i;
+
+	if(vnet_hdr->csum_start + vnet_hdr->csum_offset + sizeof(uint16_t)
+	> packet->slot_size)
+		return;
+
+	/* Checksum field holds the pseudo header sum */
+	data = packet->slot_buf + vnet_hdr->csum_start;
+	len = packet->slot_size - vnet_hdr->csum_start;
+
+	sum = 0;
+	for(i = 0; i + 1 < len; i += 2){
+		sum += *(uint16_t *)(data + i);
+	}
+
+	if(len & 1){
+		last = 0;
+		memcpy(&last, data + len - 1, 1);
+		sum += last;
+	}
+
+	while(sum >> 16){
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+
+	/* Zero means no checksum for UDP */
+	check = ~sum;
+	if(!check && vnet_hdr->csum_offset == offsetof(struct udphdr, check))
+		check = 0xffff;
+
+	*(uint16_t *)(data + vnet_hdr->csum_offset) = check;
+	return;
+}
+
+static int forward_tun_write(struct ufpd_thread *thread,
 	unsigned int port_index, struct ufp_packet *packet)
 {
-	int fd, ret;
+	struct virtio_net_hdr	vnet_hdr;
+	struct iovec		iov[2];
+	int			fd;
+
+	memset(&vnet_hdr, 0, sizeof(struct virtio_net_hdr));
+	iov[0].iov_base = &vnet_hdr;
+	iov[0].iov_len = sizeof(struct virtio_net_hdr);
+	iov[1].iov_base = packet->slot_buf;
+	iov[1].iov_len = packet->slot_size;
 
 	fd = ufp_tun_fd(thread->plane, port_index);
-	ret = write(fd, packet->slot_buf, packet->slot_size);
+	return writev(fd, iov, 2);
+}
+
+static int forward_arp_process(struct ufpd_thread *thread,
+	unsigned int port_index, struct ufp_packet *packet)
+{
+	int ret;
+
+	ret = forward_tun_write(thread, port_index, packet);
 	if(ret < 0)
 		goto err_write_tun;
 
@@ -141,50 +465,35 @@ err_write_tun:
 	return -1;
 }
 
-static int forward_ip_process(struct ufpd_thread *thread,
+static int forward_local_process(struct ufpd_thread *thread,
 	unsigned int port_index, struct ufp_packet *packet)
+{
+	forward_tun_write(thread, port_index, packet);
+	return -1;
+}
+
+static int forward_ip_process(struct ufpd_thread *thread,
+	unsigned int port_index, struct ufp_packet *packet,
+	struct fib_entry *fib_entry, struct fib_adj *adj,
+	struct neigh_entry *neigh_entry)
 {
 	struct ethhdr		*eth;
 	struct iphdr		*ip;
-	struct fib_entry	*fib_entry;
-	struct neigh_entry	*neigh_entry;
-	void			*dst_mac, *src_mac;
 	uint32_t		check;
-	int			fd, ret;
+	int			ret;
 
 	eth = (struct ethhdr *)packet->slot_buf;
 	ip = (struct iphdr *)(packet->slot_buf + sizeof(struct ethhdr));
 
-	fib_entry = fib_lookup(thread->fib_inet, &ip->daddr);
 	if(!fib_entry)
 		goto packet_drop;
 
-	if(unlikely(fib_entry->port_index < 0))
-		goto packet_local;
-
-	switch(fib_entry->type){
-	case FIB_TYPE_LOCAL:
-		goto packet_local;
-		break;
-	case FIB_TYPE_LINK:
-		neigh_entry = neigh_lookup(
-			thread->neigh_inet[fib_entry->port_index],
-			&ip->daddr);
-		break;
-	case FIB_TYPE_FORWARD:
-		neigh_entry = neigh_lookup(
-			thread->neigh_inet[fib_entry->port_index],
-			fib_entry->nexthop);
-		break;
-	default:
-		neigh_entry = NULL;
-		break;
-	}
-
-	if(!neigh_entry)
+	if(unlikely(ip->ttl == 1))
 		goto packet_local;
 
-	if(unlikely(ip->ttl == 1))
+	/* LOCAL route and unresolved neighbor go to the kernel */
+	ret = forward_l2_rewrite(thread, eth, fib_entry, adj, neigh_entry);
+	if(ret < 0)
 		goto packet_local;
 
 	ip->ttl--;
@@ -193,83 +502,138 @@ static int forward_ip_process(struct ufpd_thread *thread,
 	check += htons(0x0100);
 	ip->check = check + ((check >= 0xFFFF) ? 1 : 0);
 
-	dst_mac = neigh_entry->dst_mac;
-	src_mac = ufp_macaddr(thread->plane, fib_entry->port_index);
-	memcpy(eth->h_dest, dst_mac, ETH_ALEN);
-	memcpy(eth->h_source, src_mac, ETH_ALEN);
-
-	ret = fib_entry->port_index;
 	return ret;
 
 packet_local:
-	fd = ufp_tun_fd(thread->plane, port_index);
-	write(fd, packet->slot_buf, packet->slot_size);
+	forward_tun_write(thread, port_index, packet);
 packet_drop:
 	return -1;
 }
 
 static int forward_ip6_process(struct ufpd_thread *thread,
-	unsigned int port_index, struct ufp_packet *packet)
+	unsigned int port_index, struct ufp_packet *packet,
+	struct fib_entry *fib_entry, struct fib_adj *adj,
+	struct neigh_entry *neigh_entry)
 {
 	struct ethhdr		*eth;
 	struct ip6_hdr		*ip6;
-	struct fib_entry	*fib_entry;
-	struct neigh_entry	*neigh_entry;
-	void			*dst_mac, *src_mac;
-	int			fd, ret;
+	int			ret;
 
 	eth = (struct ethhdr *)packet->slot_buf;
 	ip6 = (struct ip6_hdr *)(packet->slot_buf + sizeof(struct ethhdr));
 
-	if(unlikely(IN6_IS_ADDR_LINKLOCAL(&ip6->ip6_dst)))
-		goto packet_local;
-
-	fib_entry = fib_lookup(thread->fib_inet6, (uint32_t *)&ip6->ip6_dst);
 	if(!fib_entry)
 		goto packet_drop;
 
-	if(unlikely(fib_entry->port_index < 0))
-		goto packet_local;
-
-	switch(fib_entry->type){
-	case FIB_TYPE_LOCAL:
-		goto packet_local;
-		break;
-	case FIB_TYPE_LINK:
-		neigh_entry = neigh_lookup(
-			thread->neigh_inet6[fib_entry->port_index],
-			&ip6->ip6_dst);
-		break;
-	case FIB_TYPE_FORWARD:
-		neigh_entry = neigh_lookup(
-			thread->neigh_inet6[fib_entry->port_index],
-			fib_entry->nexthop);
-		break;
-	default:
-		neigh_entry = NULL;
-		break;
-	}
-
-	if(!neigh_entry)
+	if(unlikely(ip6->ip6_hlim == 1))
 		goto packet_local;
 
-	if(unlikely(ip6->ip6_hlim == 1))
+	/* LOCAL route and unresolved neighbor go to the kernel */
+	ret = forward_l2_rewrite(thread, eth, fib_entry, adj, neigh_entry);
+	if(ret < 0)
 		goto packet_local;
 
 	ip6->ip6_hlim--;
 
-	dst_mac = neigh_entry->dst_mac;
-	src_mac = ufp_macaddr(thread->plane, fib_entry->port_index);
-	memcpy(eth->h_dest, dst_mac, ETH_ALEN);
-	memcpy(eth->h_source, src_mac, ETH_ALEN);
-
-	ret = fib_entry->port_index;
 	return ret;
 
 packet_local:
-	fd = ufp_tun_fd(thread->plane, port_index);
-	write(fd, packet->slot_buf, packet->slot_size);
+	forward_tun_write(thread, port_index, packet);
 packet_drop:
 	return -1;
 }
 
+static inline int forward_l2_rewrite(struct ufpd_thread *thread,
+	struct ethhdr *eth, struct fib_entry *fib_entry,
+	struct fib_adj *adj, struct neigh_entry *neigh_entry)
+{
+	void *src_mac;
+
+	if(adj){
+		if(!adj->resolved)
+			goto err_unresolved;
+
+		/* Prebuilt destination and source MAC */
+		memcpy(eth, adj->eth, ETH_ALEN * 2);
+		return adj->port_index;
+	}
+
+	if(!neigh_entry)
+		goto err_unresolved;
+
+	src_mac = ufp_macaddr(thread->plane, fib_entry->port_index);
+	memcpy(eth->h_dest, neigh_entry->dst_mac, ETH_ALEN);
+	memcpy(eth->h_source, src_mac, ETH_ALEN);
+	return fib_entry->port_index;
+
+err_unresolved:
+	return -1;
+}
+
+static inline uint32_t forward_hash_mix(uint32_t hash, uint32_t val)
+{
+	hash ^= val;
+	hash *= 0x9e3779b1;
+	return (hash << 13) | (hash >> 19);
+}
+
+static inline uint32_t forward_flow_hash(int family,
+	struct ufp_packet *packet)
+{
+	struct iphdr		*ip;
+	struct ip6_hdr		*ip6;
+	uint32_t		*addr;
+	uint8_t			*l4;
+	uint32_t		hash;
+	int			proto, i;
+
+	/*
+	 * NIC already hashed addresses and ports on RX. Its low bits
+	 * picked the RX queue, so they are mixed not to pick the path.
+	 */
+	if(likely(packet->flag & UFP_PACKET_HASH))
+		return forward_hash_mix(0, packet->hash);
+
+	hash = 0;
+
+	if(family == AF_INET){
+		ip = (struct iphdr *)(packet->slot_buf
+			+ sizeof(struct ethhdr));
+		hash = forward_hash_mix(hash, ip->saddr);
+		hash = forward_hash_mix(hash, ip->daddr);
+		proto = ip->protocol;
+		l4 = (uint8_t *)ip + (ip->ihl << 2);
+
+		/* Every fragment must take the same path */
+		if(ip->frag_off & htons(IP_MF | IP_OFFMASK))
+			proto = -1;
+	}else{
+		ip6 = (struct ip6_hdr *)(packet->slot_buf
+			+ sizeof(struct ethhdr));
+		addr = (uint32_t *)&ip6->ip6_src;
+		for(i = 0; i < 8; i++){
+			hash = forward_hash_mix(hash, addr[i]);
+		}
+		proto = ip6->ip6_nxt;
+		l4 = (uint8_t *)(ip6 + 1);
+	}
+
+	hash = forward_hash_mix(hash, proto);
+
+	switch(proto){
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_SCTP:
+		/* Source and destination port */
+		hash = forward_hash_mix(hash, *(uint32_t *)l4);
+		break;
+	default:
+		break;
+	}
+
+	/* Finalize so that low order bits depend on every input */
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	return hash;
+}
@@ -3,6 +3,15 @@
 
 #include "thread.h"
 
+#define FORWARD_BULK 32
+#define FORWARD_STAGE 256
+
+/* Packets routed to one output port, sent together per RX burst */
+struct forward_stage {
+	unsigned int		num;
+	struct ufp_packet	*packet[FORWARD_STAGE];
+};
+
 void forward_process(struct ufpd_thread *thread, unsigned int port_index,
 	struct ufp_packet *packet, int num_packet);
 void forward_process_tun(struct ufpd_thread *thread, unsigned int port_index,
@@ -121,4 +121,3 @@ struct hash_entry *hash_lookup(struct hash_table *table,
 
         return entry;
 }
-
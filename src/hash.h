@@ -7,6 +7,8 @@
 #define HASH_BIT 16
 #define HASH_SIZE (1 << HASH_BIT)
 
+#define GOLDEN_RATIO_PRIME_64 0x9e37fffffffc0001UL
+
 #define hash_entry(ptr, type, member)	\
 	container_of(ptr, type, member)
 
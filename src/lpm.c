@@ -14,13 +14,21 @@ static unsigned int lpm_index(void *prefix, unsigned int offset,
 	unsigned int range);
 static struct hlist_head *_lpm_lookup(void *dst,
 	struct lpm_node *parent, unsigned int offset);
-static int _lpm_add(struct lpm_table *table, void *prefix,
+static struct lpm_entry *_lpm_lookup_prefix(struct lpm_table *table,
+	void *prefix, unsigned int prefix_len,
+	struct lpm_node *parent, unsigned int offset);
+static struct lpm_entry *_lpm_find(struct lpm_table *table, void *prefix,
 	unsigned int prefix_len, unsigned int id,
-	void *ptr, struct ufp_mpool *mpool,
 	struct lpm_node *parent, unsigned int offset);
+static int _lpm_add(struct lpm_table *table, void *prefix,
+	unsigned int prefix_len, unsigned int id,
+	void *ptr, struct lpm_node *parent, unsigned int offset);
 static int _lpm_delete(struct lpm_table *table, void *prefix,
 	unsigned int prefix_len, unsigned int id,
 	struct lpm_node *parent, unsigned int offset);
+static int _lpm_replace(struct lpm_table *table, void *prefix,
+	unsigned int prefix_len, unsigned int id,
+	void *ptr, struct lpm_node *parent, unsigned int offset);
 static void _lpm_delete_all(struct lpm_table *table,
 	struct lpm_node *parent);
 static int _lpm_traverse(struct lpm_table *table, void *prefix,
@@ -31,17 +39,45 @@ static int lpm_entry_insert(struct lpm_table *table, struct hlist_head *head,
 static int lpm_entry_delete(struct lpm_table *table, struct hlist_head *head,
 	unsigned int id, unsigned int prefix_len);
 static void lpm_entry_delete_all(struct lpm_table *table, struct hlist_head *head);
-
-void lpm_init(struct lpm_table *table)
+static struct lpm_entry *lpm_entry_first(struct lpm_table *table,
+	struct hlist_head *head, unsigned int prefix_len);
+static struct lpm_entry *lpm_entry_find(struct lpm_table *table,
+	struct hlist_head *head, unsigned int id, unsigned int prefix_len);
+static int lpm_entry_replace(struct lpm_table *table, struct hlist_head *head,
+	unsigned int id, unsigned int prefix_len, void *ptr);
+
+int lpm_init(struct lpm_table *table, struct ufp_mpool *mpool)
 {
 	struct lpm_node *node;
 	int i;
 
+	table->entry_cache = ufp_mcache_alloc(mpool,
+		sizeof(struct lpm_entry));
+	if(!table->entry_cache)
+		goto err_entry_cache;
+
+	table->node_cache = ufp_mcache_alloc(mpool,
+		sizeof(struct lpm_node) * TABLE_SIZE_8);
+	if(!table->node_cache)
+		goto err_node_cache;
+
 	for(i = 0; i < TABLE_SIZE_16; i++){
 		node = &table->node[i];
 		lpm_init_node(node);
 	}
 
+	return 0;
+
+err_node_cache:
+	ufp_mcache_release(table->entry_cache);
+err_entry_cache:
+	return -1;
+}
+
+void lpm_destroy(struct lpm_table *table)
+{
+	ufp_mcache_release(table->node_cache);
+	ufp_mcache_release(table->entry_cache);
 	return;
 }
 
@@ -113,9 +149,99 @@ static struct hlist_head *_lpm_lookup(void *dst,
 	return head;
 }
 
+struct lpm_entry *lpm_lookup_prefix(struct lpm_table *table,
+	void *prefix, unsigned int prefix_len)
+{
+	unsigned int index;
+	struct lpm_node *node;
+	struct lpm_entry *entry, *entry_child;
+
+	index = lpm_index(prefix, 0, 16);
+	node = &table->node[index];
+
+	/* Entries in a deeper level always have longer prefix */
+	entry = lpm_entry_first(table, &node->head, prefix_len);
+	if(prefix_len > 16 && node->next_table){
+		entry_child = _lpm_lookup_prefix(table, prefix, prefix_len,
+			node, 16);
+		if(entry_child)
+			entry = entry_child;
+	}
+
+	return entry;
+}
+
+static struct lpm_entry *_lpm_lookup_prefix(struct lpm_table *table,
+	void *prefix, unsigned int prefix_len,
+	struct lpm_node *parent, unsigned int offset)
+{
+	unsigned int index;
+	struct lpm_node *node;
+	struct lpm_entry *entry, *entry_child;
+
+	index = lpm_index(prefix, offset, 8);
+	node = &parent->next_table[index];
+
+	entry = lpm_entry_first(table, &node->head, prefix_len);
+	if(prefix_len > offset + 8 && node->next_table){
+		entry_child = _lpm_lookup_prefix(table, prefix, prefix_len,
+			node, offset + 8);
+		if(entry_child)
+			entry = entry_child;
+	}
+
+	return entry;
+}
+
+struct lpm_entry *lpm_find(struct lpm_table *table, void *prefix,
+	unsigned int prefix_len, unsigned int id)
+{
+	unsigned int index;
+	struct lpm_node *node;
+	struct lpm_entry *entry;
+
+	index = lpm_index(prefix, 0, 16);
+	node = &table->node[index];
+
+	if(prefix_len > 16){
+		entry = _lpm_find(table, prefix, prefix_len, id, node, 16);
+	}else{
+		entry = lpm_entry_find(table, &node->head, id, prefix_len);
+	}
+
+	return entry;
+}
+
+static struct lpm_entry *_lpm_find(struct lpm_table *table, void *prefix,
+	unsigned int prefix_len, unsigned int id,
+	struct lpm_node *parent, unsigned int offset)
+{
+	unsigned int index;
+	struct lpm_node *node;
+	struct lpm_entry *entry;
+
+	if(!parent->next_table)
+		goto err_find;
+
+	index = lpm_index(prefix, offset, 8);
+	node = &parent->next_table[index];
+
+	if(prefix_len - offset > 8){
+		entry = _lpm_find(table, prefix, prefix_len, id,
+			node, offset + 8);
+	}else{
+		entry = lpm_entry_find(table, &node->head, id, prefix_len);
+	}
+
+	return entry;
+
+err_find:
+	return NULL;
+}
+
 int lpm_add(struct lpm_table *table, void *prefix,
 	unsigned int prefix_len, unsigned int id,
-	void *ptr, struct ufp_mpool *mpool)
+	void *ptr)
 {
 	unsigned int index;
 	struct lpm_node *node;
@@ -128,7 +254,7 @@ int lpm_add(struct lpm_table *table, void *prefix,
 	if(prefix_len > 16){
 		node = &table->node[index];
 		ret = _lpm_add(table, prefix, prefix_len, id,
-			ptr, mpool, node, 16);
+			ptr, node, 16);
 		if(ret < 0)
 			goto err_lpm_add;
 	}else{
@@ -139,8 +265,7 @@ int lpm_add(struct lpm_table *table, void *prefix,
 		for(i = 0; i < range; i++, entry_allocated++){
 			node = &table->node[index | i];
 
-			entry = ufp_mem_alloc(mpool,
-				sizeof(struct lpm_entry));
+			entry = ufp_mcache_get(table->entry_cache);
 			if(!entry)
 				goto err_lpm_add_self;
 
@@ -153,7 +278,7 @@ int lpm_add(struct lpm_table *table, void *prefix,
 
 			continue;
 err_entry_insert:
-			ufp_mem_free(entry);
+			ufp_mcache_put(table->entry_cache, entry);
 			goto err_lpm_add_self;
 		}
 	}
@@ -171,8 +296,7 @@ err_lpm_add:
 
 static int _lpm_add(struct lpm_table *table, void *prefix,
 	unsigned int prefix_len, unsigned int id,
-	void *ptr, struct ufp_mpool *mpool,
-	struct lpm_node *parent, unsigned int offset)
+	void *ptr, struct lpm_node *parent, unsigned int offset)
 {
 	struct lpm_node *node;
 	struct lpm_entry *entry;
@@ -181,8 +305,7 @@ static int _lpm_add(struct lpm_table *table, void *prefix,
 	int i, ret, entry_allocated = 0;
 
 	if(!parent->next_table){
-		parent->next_table = ufp_mem_alloc(mpool,
-			sizeof(struct lpm_node) * TABLE_SIZE_8);
+		parent->next_table = ufp_mcache_get(table->node_cache);
 		if(!parent->next_table)
 			goto err_table_alloc;
 
@@ -197,7 +320,7 @@ static int _lpm_add(struct lpm_table *table, void *prefix,
 	if(prefix_len - offset > 8){
 		node = &parent->next_table[index];
 		ret = _lpm_add(table, prefix, prefix_len, id,
-			ptr, mpool, node, offset + 8);
+			ptr, node, offset + 8);
 		if(ret < 0)
 			goto err_lpm_add;
 	}else{
@@ -208,8 +331,7 @@ static int _lpm_add(struct lpm_table *table, void *prefix,
 		for(i = 0; i < range; i++){
 			node = &parent->next_table[index | i];
 
-			entry = ufp_mem_alloc(mpool,
-				sizeof(struct lpm_entry));
+			entry = ufp_mcache_get(table->entry_cache);
 			if(!entry)
 				goto err_lpm_add_self;
 
@@ -222,7 +344,7 @@ static int _lpm_add(struct lpm_table *table, void *prefix,
 
 			continue;
 err_entry_insert:
-			ufp_mem_free(entry);
+			ufp_mcache_put(table->entry_cache, entry);
 			goto err_lpm_add_self;
 		}
 	}
@@ -241,7 +363,7 @@ err_lpm_add:
 			goto err_table_alloc;
 		}
 	}
-	ufp_mem_free(parent->next_table);
+	ufp_mcache_put(table->node_cache, parent->next_table);
 	parent->next_table = NULL;
 err_table_alloc:
         return -1;
@@ -320,7 +442,7 @@ static int _lpm_delete(struct lpm_table *table, void *prefix,
 		}
 	}
 
-	ufp_mem_free(parent->next_table);
+	ufp_mcache_put(table->node_cache, parent->next_table);
 	parent->next_table = NULL;
 
 out:
@@ -329,6 +451,83 @@ err_delete:
 	return -1;
 }
 
+int lpm_replace(struct lpm_table *table, void *prefix,
+	unsigned int prefix_len, unsigned int id,
+	void *ptr)
+{
+	unsigned int index;
+	struct lpm_node *node;
+	unsigned int range, mask;
+	int i, ret;
+
+	index = lpm_index(prefix, 0, 16);
+
+	if(prefix_len > 16){
+		node = &table->node[index];
+		ret = _lpm_replace(table, prefix, prefix_len, id,
+			ptr, node, 16);
+		if(ret < 0)
+			goto err_replace;
+	}else{
+		range = 1 << (16 - prefix_len);
+		mask = ~(range - 1);
+		index &= mask;
+
+		for(i = 0; i < range; i++){
+			node = &table->node[index | i];
+			ret = lpm_entry_replace(table, &node->head, id,
+				prefix_len, ptr);
+			if(ret < 0)
+				goto err_replace;
+		}
+	}
+
+	return 0;
+
+err_replace:
+	return -1;
+}
+
+static int _lpm_replace(struct lpm_table *table, void *prefix,
+	unsigned int prefix_len, unsigned int id,
+	void *ptr, struct lpm_node *parent, unsigned int offset)
+{
+	struct lpm_node *node;
+	unsigned int index;
+	unsigned int range, mask;
+	int i, ret;
+
+	if(!parent->next_table)
+		goto err_replace;
+
+	index = lpm_index(prefix, offset, 8);
+
+	if(prefix_len - offset > 8){
+		node = &parent->next_table[index];
+		ret = _lpm_replace(table, prefix, prefix_len, id,
+			ptr, node, offset + 8);
+		if(ret < 0)
+			goto err_replace;
+	}else{
+		range = 1 << (8 - (prefix_len - offset));
+		mask = ~(range - 1);
+		index &= mask;
+
+		for(i = 0; i < range; i++){
+			node = &parent->next_table[index | i];
+			ret = lpm_entry_replace(table, &node->head, id,
+				prefix_len, ptr);
+			if(ret < 0)
+				goto err_replace;
+		}
+	}
+
+	return 0;
+
+err_replace:
+	return -1;
+}
+
 void lpm_delete_all(struct lpm_table *table)
 {
 	struct lpm_node *node;
@@ -362,7 +561,7 @@ static void _lpm_delete_all(struct lpm_table *table,
 		}
 	}
 
-	ufp_mem_free(parent->next_table);
+	ufp_mcache_put(table->node_cache, parent->next_table);
 	parent->next_table = NULL;
 
 out:
@@ -472,7 +671,7 @@ static int lpm_entry_delete(struct lpm_table *table, struct hlist_head *head,
 		if(!table->entry_identify(entry_lpm->ptr, id, prefix_len)){
 			hlist_del(&entry_lpm->list);
 			table->entry_put(entry_lpm->ptr);
-			ufp_mem_free(entry_lpm);
+			ufp_mcache_put(table->entry_cache, entry_lpm);
 
 			return 0;
 		}
@@ -481,6 +680,26 @@ static int lpm_entry_delete(struct lpm_table *table, struct hlist_head *head,
 	return -1;
 }
 
+static int lpm_entry_replace(struct lpm_table *table, struct hlist_head *head,
+	unsigned int id, unsigned int prefix_len, void *ptr)
+{
+	struct lpm_entry *entry_lpm;
+
+	entry_lpm = lpm_entry_find(table, head, id, prefix_len);
+	if(!entry_lpm)
+		goto err_not_found;
+
+	/* Each node moves its own reference to the new entry */
+	table->entry_pull(ptr);
+	table->entry_put(entry_lpm->ptr);
+	entry_lpm->ptr = ptr;
+
+	return 0;
+
+err_not_found:
+	return -1;
+}
+
 static void lpm_entry_delete_all(struct lpm_table *table, struct hlist_head *head)
 {
 	struct lpm_entry *entry_lpm, *temp;
@@ -488,9 +707,35 @@ static void lpm_entry_delete_all(struct lpm_table *table, struct hlist_head *hea
 	hlist_for_each_safe(head, entry_lpm, list, temp){
 		hlist_del(&entry_lpm->list);
 		table->entry_put(entry_lpm->ptr);
-		ufp_mem_free(entry_lpm);
+		ufp_mcache_put(table->entry_cache, entry_lpm);
 	}
 
 	return;
 }
 
+static struct lpm_entry *lpm_entry_first(struct lpm_table *table,
+	struct hlist_head *head, unsigned int prefix_len)
+{
+	struct lpm_entry *entry_lpm;
+
+	/* Entries are sorted by prefix length in descending order */
+	hlist_for_each(head, entry_lpm, list){
+		if(!table->entry_compare(entry_lpm->ptr, prefix_len))
+			return entry_lpm;
+	}
+
+	return NULL;
+}
+
+static struct lpm_entry *lpm_entry_find(struct lpm_table *table,
+	struct hlist_head *head, unsigned int id, unsigned int prefix_len)
+{
+	struct lpm_entry *entry_lpm;
+
+	hlist_for_each(head, entry_lpm, list){
+		if(!table->entry_identify(entry_lpm->ptr, id, prefix_len))
+			return entry_lpm;
+	}
+
+	return NULL;
+}
@@ -18,6 +18,8 @@ struct lpm_node {
 
 struct lpm_table {
 	struct lpm_node		node[TABLE_SIZE_16];
+	struct ufp_mcache	*entry_cache;
+	struct ufp_mcache	*node_cache; /* next_table */
 	void			(*entry_dump)(
 				struct hlist_head *
 				);
@@ -38,14 +40,22 @@ struct lpm_table {
 				);
 };
 
-void lpm_init(struct lpm_table *table);
+int lpm_init(struct lpm_table *table, struct ufp_mpool *mpool);
+void lpm_destroy(struct lpm_table *table);
 struct lpm_entry *lpm_lookup(struct lpm_table *table,
 	void *dst);
+struct lpm_entry *lpm_lookup_prefix(struct lpm_table *table,
+	void *prefix, unsigned int prefix_len);
+struct lpm_entry *lpm_find(struct lpm_table *table, void *prefix,
+	unsigned int prefix_len, unsigned int id);
 int lpm_add(struct lpm_table *table, void *prefix,
 	unsigned int prefix_len, unsigned int id,
-	void *ptr, struct ufp_mpool *mpool);
+	void *ptr);
 int lpm_delete(struct lpm_table *table, void *prefix,
 	unsigned int prefix_len, unsigned int id);
+int lpm_replace(struct lpm_table *table, void *prefix,
+	unsigned int prefix_len, unsigned int id,
+	void *ptr);
 void lpm_delete_all(struct lpm_table *table);
 int lpm_traverse(struct lpm_table *table, void *prefix,
 	unsigned int prefix_len);
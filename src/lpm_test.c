@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <stddef.h>
+#include <ufp.h>
+
+#include "main.h"
+#include "lpm.h"
+
+struct test_route {
+	unsigned int		id;
+	unsigned int		prefix_len;
+	int			refcount;
+};
+
+struct ufp_mcache {
+	size_t			size;
+};
+
+static int test_replace(struct lpm_table *table, const char *addr,
+	unsigned int prefix_len, const char **hits, const char *miss);
+static struct test_route *test_lookup(struct lpm_table *table,
+	const char *addr);
+static void test_dump(struct hlist_head *head);
+static int test_identify(void *ptr, unsigned int id,
+	unsigned int prefix_len);
+static int test_compare(void *ptr, unsigned int prefix_len);
+static void test_pull(void *ptr);
+static void test_put(void *ptr);
+
+/* Heap backed caches, as mpool needs hugepages */
+struct ufp_mcache *ufp_mcache_alloc(struct ufp_mpool *mpool, size_t size)
+{
+	struct ufp_mcache *cache;
+
+	cache = malloc(sizeof(struct ufp_mcache));
+	if(!cache)
+		return NULL;
+
+	cache->size = size;
+	return cache;
+}
+
+void ufp_mcache_release(struct ufp_mcache *cache)
+{
+	free(cache);
+	return;
+}
+
+void *ufp_mcache_get(struct ufp_mcache *cache)
+{
+	return malloc(cache->size);
+}
+
+void ufp_mcache_put(struct ufp_mcache *cache, void *obj)
+{
+	free(obj);
+	return;
+}
+
+int main(int argc, char **argv)
+{
+	struct lpm_table *table;
+	const char *hits_8[] = {
+		"10.0.0.0", "10.0.0.1", "10.128.64.32",
+		"10.255.255.255", NULL
+	};
+	const char *hits_20[] = {
+		"172.16.0.0", "172.16.8.1", "172.16.15.255", NULL
+	};
+	int ret;
+
+	table = malloc(sizeof(struct lpm_table));
+	if(!table)
+		goto err_table_alloc;
+
+	ret = lpm_init(table, NULL);
+	if(ret < 0)
+		goto err_lpm_init;
+
+	table->entry_dump	= test_dump;
+	table->entry_identify	= test_identify;
+	table->entry_compare	= test_compare;
+	table->entry_pull	= test_pull;
+	table->entry_put	= test_put;
+
+	ret = test_replace(table, "10.0.0.0", 8, hits_8, "11.0.0.0");
+	if(ret < 0)
+		goto err_test;
+
+	ret = test_replace(table, "172.16.0.0", 20, hits_20, "172.16.16.0");
+	if(ret < 0)
+		goto err_test;
+
+	lpm_destroy(table);
+	free(table);
+	return 0;
+
+err_test:
+	lpm_delete_all(table);
+	lpm_destroy(table);
+err_lpm_init:
+	free(table);
+err_table_alloc:
+	return 1;
+}
+
+static int test_replace(struct lpm_table *table, const char *addr,
+	unsigned int prefix_len, const char **hits, const char *miss)
+{
+	struct test_route route_old = { 1, prefix_len, 0 };
+	struct test_route route_new = { 2, prefix_len, 0 };
+	uint32_t prefix;
+	int i, ret;
+
+	inet_pton(AF_INET, addr, &prefix);
+
+	ret = lpm_add(table, &prefix, prefix_len, route_old.id, &route_old);
+	if(ret < 0)
+		goto err_add;
+
+	ret = lpm_replace(table, &prefix, prefix_len, route_old.id,
+		&route_new);
+	if(ret < 0)
+		goto err_replace;
+
+	/* No expanded node may keep the old route */
+	if(route_old.refcount)
+		goto err_replace;
+
+	for(i = 0; hits[i]; i++){
+		if(test_lookup(table, hits[i]) != &route_new)
+			goto err_replace;
+	}
+
+	if(test_lookup(table, miss))
+		goto err_replace;
+
+	ret = lpm_delete(table, &prefix, prefix_len, route_new.id);
+	if(ret < 0)
+		goto err_replace;
+
+	if(route_new.refcount)
+		goto err_delete;
+
+	for(i = 0; hits[i]; i++){
+		if(test_lookup(table, hits[i]))
+			goto err_delete;
+	}
+
+	return 0;
+
+err_replace:
+	lpm_delete_all(table);
+err_delete:
+	fprintf(stderr, "lpm: replace of %s/%u failed\n", addr, prefix_len);
+err_add:
+	return -1;
+}
+
+static struct test_route *test_lookup(struct lpm_table *table,
+	const char *addr)
+{
+	struct lpm_entry *entry;
+	uint32_t dst;
+
+	inet_pton(AF_INET, addr, &dst);
+
+	entry = lpm_lookup(table, &dst);
+	return entry ? entry->ptr : NULL;
+}
+
+static void test_dump(struct hlist_head *head)
+{
+	return;
+}
+
+static int test_identify(void *ptr, unsigned int id,
+	unsigned int prefix_len)
+{
+	struct test_route *route;
+
+	route = ptr;
+
+	if(route->id == id
+	&& route->prefix_len == prefix_len){
+		return 0;
+	}else{
+		return 1;
+	}
+}
+
+static int test_compare(void *ptr, unsigned int prefix_len)
+{
+	struct test_route *route;
+
+	route = ptr;
+
+	return route->prefix_len > prefix_len ?
+		1 : 0;
+}
+
+static void test_pull(void *ptr)
+{
+	struct test_route *route;
+
+	route = ptr;
+	route->refcount++;
+
+	return;
+}
+
+static void test_put(void *ptr)
+{
+	struct test_route *route;
+
+	route = ptr;
+	route->refcount--;
+
+	return;
+}
@@ -11,14 +11,14 @@
 #include <sys/signalfd.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
-#include <sys/syscall.h>
-#include <linux/mempolicy.h>
+#include <dirent.h>
 #include <stdarg.h>
 #include <syslog.h>
 #include <ufp.h>
 
 #include "main.h"
 #include "thread.h"
+#include "control.h"
 
 static void usage();
 static int ufpd_device_init(struct ufpd *ufpd, int dev_idx);
@@ -27,8 +27,17 @@ static int ufpd_thread_create(struct ufpd *ufpd,
 	struct ufpd_thread *thread, unsigned int thread_id,
 	unsigned int core_id);
 static void ufpd_thread_kill(struct ufpd_thread *thread);
+static int ufpd_fib_init(struct ufpd *ufpd);
+static void ufpd_fib_destroy(struct ufpd *ufpd);
+static int ufpd_control_create(struct ufpd *ufpd,
+	struct ufpd_control *control, struct ufpd_thread *thread);
+static void ufpd_control_kill(struct ufpd_control *control);
 static int ufpd_set_signal(sigset_t *sigset);
-static int ufpd_set_mempolicy(unsigned int node);
+static int ufpd_core_node(struct ufpd *ufpd, unsigned int core_id);
+static int ufpd_dev_node(struct ufpd *ufpd, int dev_idx);
+static void ufpd_node_report(struct ufpd *ufpd);
+static struct ufp_mpool *ufpd_dev_mpool(struct ufpd *ufpd,
+	unsigned int thread_id, int dev_idx);
 static int ufpd_parse_args(struct ufpd *ufpd, int argc, char **argv);
 static int ufpd_parse_range(const char *str, char *result, int max_len);
 static int ufpd_parse_list(const char *str, char **result, int max_len,
@@ -44,10 +53,20 @@ static void usage()
 	printf("Usage:\n");
 	printf("  -c [cpulist] : CPU cores to use\n");
 	printf("  -p [ifnamelist] : Interfaces to use\n");
-	printf("  -n [n] : NUMA node (default=0)\n");
+	printf("  -n [n] : NUMA node of control memory (default=0)\n");
+	printf("  -M [n] : Memory pool size per thread in MB"
+		" (default=%d)\n", UFPD_MPOOL_SIZE);
 	printf("  -m [n] : MTU length (default=1522)\n");
-	printf("  -b [n] : Number of packet buffer per port(default=8192)\n");
+	printf("  -b [n] : Number of packet buffer per NUMA node"
+		" of each thread(default=32768)\n");
 	printf("  -a : Promiscuous mode (default=disabled)\n");
+	printf("  -s : Share one FIB among threads (default=disabled)\n");
+	printf("  -P [cpulist] : CPU cores to busy-poll instead of IRQ\n");
+	printf("  -t [n] : RX burst to switch from IRQ to polling"
+		" (default=%d, 0=disabled)\n", UFPD_RX_BUDGET);
+	printf("  -k [n] : Empty polls before re-arming IRQ (default=%d)\n",
+		UFPD_ADAPT_IDLE);
+	printf("  -x : Reap TX without TX IRQ (default=disabled)\n");
 	printf("  -h : Show this help\n");
 	printf("\n");
 	return;
@@ -57,24 +76,39 @@ int main(int argc, char **argv)
 {
 	struct ufpd		ufpd;
 	struct ufpd_thread	*threads;
+	struct ufpd_control	control;
 	int			err, ret, i, signal;
 	int			ifnames_done = 0,
 				threads_done = 0,
 				devices_done = 0,
-				mpool_done = 0;
+				mpool_done = 0,
+				rings_done = 0,
+				fib_done = 0,
+				control_done = 0;
 	sigset_t		sigset;
 
 	/* set default values */
 	ufpd.numa_node		= 0;
+	ufpd.mpool_size		= UFPD_MPOOL_SIZE;
 	ufpd.num_threads	= 0;
 	ufpd.num_devices	= 0;
 	ufpd.promisc		= 0;
+	ufpd.fib_shared		= 0;
+	ufpd.num_poll_cores	= 0;
+	ufpd.adapt_threshold	= UFPD_RX_BUDGET;
+	ufpd.adapt_idle		= UFPD_ADAPT_IDLE;
+	ufpd.no_tx_irq		= 0;
+	ufpd.mpool_ctrl		= NULL;
+	memset(ufpd.mpools_node, 0, sizeof(ufpd.mpools_node));
+	ufpd.rcu		= NULL;
+	ufpd.fib_inet		= NULL;
+	ufpd.fib_inet6		= NULL;
 	/* 1500 + ETH_HLEN(14) + ETH_FCS_LEN(4) = 1518 */
 	ufpd.mtu_frame		= 1518;
 	/* size of packet buffer */
 	ufpd.buf_size		= 2048;
 	/* number of per port packet buffer */
-	ufpd.buf_count		= 8192;
+	ufpd.buf_count		= 32768;
 
 	for(i = 0; i < UFPD_MAX_IFS; i++, ifnames_done++){
 		ufpd.ifnames[i] = malloc(UFPD_MAX_ARGLEN);
@@ -90,12 +124,6 @@ int main(int argc, char **argv)
 
 	openlog(PROCESS_NAME, LOG_CONS | LOG_PID, SYSLOG_FACILITY);
 
-	err = ufpd_set_mempolicy(ufpd.numa_node);
-	if(err < 0){
-		ret = -1;
-		goto err_set_mempolicy;
-	}
-
 	ufpd.devs = malloc(sizeof(struct ufp_dev *) * ufpd.num_devices);
 	if(!ufpd.devs){
 		ret = -1;
@@ -114,14 +142,62 @@ int main(int argc, char **argv)
 		goto err_alloc_threads;
 	}
 
+	ufpd.rings = malloc(sizeof(struct control_ring *) * ufpd.num_threads);
+	if(!ufpd.rings){
+		ret = -1;
+		goto err_alloc_rings;
+	}
+
+	for(i = 0; i < ufpd.num_threads; i++, rings_done++){
+		ufpd.rings[i] = control_ring_alloc(CONTROL_RING_SIZE);
+		if(!ufpd.rings[i]){
+			ret = -1;
+			goto err_ring_alloc;
+		}
+	}
+
+	for(i = 0; i < ufpd.num_threads; i++){
+		ufpd.core_nodes[i] = ufpd_core_node(&ufpd, ufpd.cores[i]);
+	}
+
+	for(i = 0; i < ufpd.num_devices; i++){
+		ufpd.dev_nodes[i] = ufpd_dev_node(&ufpd, i);
+	}
+	ufpd_node_report(&ufpd);
+
+	/* Each pool comes from the node of the core using it */
 	for(i = 0; i < ufpd.num_threads; i++, mpool_done++){
-		ufpd.mpools[i] = ufp_mpool_init();
+		ufpd.mpools[i] = ufp_mpool_init(ufpd.mpool_size << 20,
+			ufpd.core_nodes[i]);
 		if(!ufpd.mpools[i]){
 			ret = -1;
 			goto err_mempool_init;
 		}
 	}
 
+	/* Rings and buffers of remote devices come from their own node */
+	for(i = 0; i < ufpd.num_devices; i++){
+		int node, j;
+
+		node = ufpd.dev_nodes[i];
+		if(node < 0 || ufpd.mpools_node[node])
+			continue;
+
+		for(j = 0; j < ufpd.num_threads; j++){
+			if(ufpd.core_nodes[j] != node)
+				break;
+		}
+		if(j == ufpd.num_threads)
+			continue;
+
+		ufpd.mpools_node[node] = ufp_mpool_init(
+			ufpd.mpool_size << 20, node);
+		if(!ufpd.mpools_node[node]){
+			ret = -1;
+			goto err_mempool_node_init;
+		}
+	}
+
 	for(i = 0; i < ufpd.num_devices; i++, devices_done++){
 		err = ufpd_device_init(&ufpd, i);
 		if(err < 0){
@@ -130,6 +206,15 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if(ufpd.fib_shared){
+		err = ufpd_fib_init(&ufpd);
+		if(err < 0){
+			ret = -1;
+			goto err_fib_init;
+		}
+		fib_done = 1;
+	}
+
 	err = ufpd_set_signal(&sigset);
 	if(err != 0){
 		ret = -1;
@@ -144,6 +229,13 @@ int main(int argc, char **argv)
 		}
 	}
 
+	err = ufpd_control_create(&ufpd, &control, &threads[0]);
+	if(err < 0){
+		ret = -1;
+		goto err_control_create;
+	}
+	control_done = 1;
+
 	while(1){
 		if(sigwait(&sigset, &signal) == 0){
 			break;
@@ -151,26 +243,43 @@ int main(int argc, char **argv)
 	}
 	ret = 0;
 
+	/* Stop feeding updates before workers go away */
+	if(control_done)
+		ufpd_control_kill(&control);
+err_control_create:
 err_thread_create:
 	for(i = 0; i < threads_done; i++){
 		ufpd_thread_kill(&threads[i]);
 	}
 err_set_signal:
+	if(fib_done)
+		ufpd_fib_destroy(&ufpd);
+err_fib_init:
 err_init_device:
 	for(i = 0; i < devices_done; i++){
 		ufpd_device_destroy(&ufpd, i);
 	}
+err_mempool_node_init:
+	for(i = 0; i < UFPD_MAX_NODES; i++){
+		if(ufpd.mpools_node[i])
+			ufp_mpool_destroy(ufpd.mpools_node[i]);
+	}
 err_mempool_init:
 	for(i = 0; i < mpool_done; i++){
 		ufp_mpool_destroy(ufpd.mpools[i]);
 	}
+err_ring_alloc:
+	for(i = 0; i < rings_done; i++){
+		control_ring_release(ufpd.rings[i]);
+	}
+	free(ufpd.rings);
+err_alloc_rings:
 	free(threads);
 err_alloc_threads:
 	free(ufpd.mpools);
 err_mpools:
 	free(ufpd.devs);
 err_devs:
-err_set_mempolicy:
 	closelog();
 err_parse_args:
 err_alloc_ifnames:
@@ -182,7 +291,8 @@ err_alloc_ifnames:
 
 static int ufpd_device_init(struct ufpd *ufpd, int dev_idx)
 {
-	int err;
+	struct ufp_mpool *mpools[UFPD_MAX_CORES];
+	int err, i;
 
 	ufpd->devs[dev_idx] = ufp_open(ufpd->ifnames[dev_idx]);
 	if(!ufpd->devs[dev_idx]){
@@ -190,7 +300,12 @@ static int ufpd_device_init(struct ufpd *ufpd, int dev_idx)
 		goto err_open;
 	}
 
-	err = ufp_up(ufpd->devs[dev_idx], ufpd->mpools,
+	/* Rings of each queue */
+	for(i = 0; i < ufpd->num_threads; i++){
+		mpools[i] = ufpd_dev_mpool(ufpd, i, dev_idx);
+	}
+
+	err = ufp_up(ufpd->devs[dev_idx], mpools,
 		ufpd->num_threads, ufpd->buf_size,
 		ufpd->mtu_frame, ufpd->promisc,
 		UFPD_RX_BUDGET, UFPD_TX_BUDGET);
@@ -217,15 +332,36 @@ static int ufpd_thread_create(struct ufpd *ufpd,
 	struct ufpd_thread *thread, unsigned int thread_id,
 	unsigned int core_id)
 {
+	struct ufp_mpool *mpools[UFPD_MAX_IFS];
 	cpu_set_t cpuset;
-	int err;
+	int err, i;
 
 	thread->id		= thread_id;
 	thread->ptid		= pthread_self();
 	thread->mpool		= ufpd->mpools[thread->id];
+	thread->fib_inet	= ufpd->fib_inet;
+	thread->fib_inet6	= ufpd->fib_inet6;
+	thread->rcu_reader	= ufpd->rcu ?
+		&ufpd->rcu->readers[thread->id] : NULL;
+	thread->control_ring	= ufpd->rings[thread->id];
+
+	thread->adapt_threshold	= ufpd->adapt_threshold;
+	thread->adapt_idle	= ufpd->adapt_idle;
+	thread->no_tx_irq	= ufpd->no_tx_irq;
+
+	thread->busy_poll = 0;
+	for(i = 0; i < ufpd->num_poll_cores; i++){
+		if(ufpd->poll_cores[i] == core_id)
+			thread->busy_poll = 1;
+	}
+
+	/* Devices on the same node share one pool, and so slots */
+	for(i = 0; i < ufpd->num_devices; i++){
+		mpools[i] = ufpd_dev_mpool(ufpd, thread->id, i);
+	}
 
 	thread->buf = ufp_alloc_buf(ufpd->devs, ufpd->num_devices,
-		ufpd->buf_size, ufpd->buf_count, thread->mpool);
+		ufpd->buf_size, ufpd->buf_count, mpools);
 	if(!thread->buf){
 		ufpd_log(LOG_ERR,
 			"failed to ufp_alloc_buf, idx = %d", thread->id);
@@ -295,6 +431,94 @@ static void ufpd_thread_kill(struct ufpd_thread *thread)
 	return;
 }
 
+static int ufpd_fib_init(struct ufpd *ufpd)
+{
+	ufpd->mpool_ctrl = ufp_mpool_init(ufpd->mpool_size << 20,
+		ufpd->numa_node);
+	if(!ufpd->mpool_ctrl)
+		goto err_mpool_init;
+
+	ufpd->rcu = rcu_alloc(ufpd->num_threads);
+	if(!ufpd->rcu)
+		goto err_rcu_alloc;
+
+	ufpd->fib_inet = fib_alloc(ufpd->mpool_ctrl, AF_INET, ufpd->rcu);
+	if(!ufpd->fib_inet)
+		goto err_fib_inet_alloc;
+
+	ufpd->fib_inet6 = fib_alloc(ufpd->mpool_ctrl, AF_INET6, ufpd->rcu);
+	if(!ufpd->fib_inet6)
+		goto err_fib_inet6_alloc;
+
+	return 0;
+
+err_fib_inet6_alloc:
+	fib_release(ufpd->fib_inet);
+err_fib_inet_alloc:
+	rcu_release(ufpd->rcu);
+err_rcu_alloc:
+	ufp_mpool_destroy(ufpd->mpool_ctrl);
+err_mpool_init:
+	return -1;
+}
+
+static void ufpd_fib_destroy(struct ufpd *ufpd)
+{
+	/* No reader remains, deferred objects must go first */
+	rcu_flush(ufpd->rcu);
+
+	fib_release(ufpd->fib_inet6);
+	fib_release(ufpd->fib_inet);
+	rcu_release(ufpd->rcu);
+	ufp_mpool_destroy(ufpd->mpool_ctrl);
+	return;
+}
+
+static int ufpd_control_create(struct ufpd *ufpd,
+	struct ufpd_control *control, struct ufpd_thread *thread)
+{
+	int err;
+
+	/* Port and tun mapping is common to every plane */
+	memset(control, 0, sizeof(struct ufpd_control));
+	control->ptid		= pthread_self();
+	control->mpool		= ufpd->mpool_ctrl;
+	control->plane		= thread->plane;
+	control->num_ports	= thread->num_ports;
+	control->fib_inet	= ufpd->fib_inet;
+	control->fib_inet6	= ufpd->fib_inet6;
+	control->rcu		= ufpd->rcu;
+	control->rings		= ufpd->rings;
+	control->num_rings	= ufpd->num_threads;
+
+	err = pthread_create(&control->tid,
+		NULL, control_process, control);
+	if(err < 0){
+		ufpd_log(LOG_ERR, "failed to create control thread");
+		goto err_pthread_create;
+	}
+
+	return 0;
+
+err_pthread_create:
+	return -1;
+}
+
+static void ufpd_control_kill(struct ufpd_control *control)
+{
+	int err;
+
+	err = pthread_kill(control->tid, SIGUSR1);
+	if(err != 0)
+		ufpd_log(LOG_ERR, "failed to kill control thread");
+
+	err = pthread_join(control->tid, NULL);
+	if(err != 0)
+		ufpd_log(LOG_ERR, "failed to join control thread");
+
+	return;
+}
+
 static int ufpd_set_signal(sigset_t *sigset)
 {
 	int err;
@@ -327,20 +551,97 @@ err_sigaddset:
 	return -1;
 }
 
-static int ufpd_set_mempolicy(unsigned int node)
+static int ufpd_core_node(struct ufpd *ufpd, unsigned int core_id)
 {
-	int err;
-	unsigned long node_mask;
+	char path[FILENAME_MAX];
+	struct dirent *entry;
+	DIR *dir;
+	int node;
+
+	/* sysfs has a "nodeN" link in the directory of each core */
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u",
+		core_id);
+	dir = opendir(path);
+	if(!dir)
+		goto err_opendir;
+
+	node = -1;
+	while((entry = readdir(dir))){
+		if(sscanf(entry->d_name, "node%d", &node) == 1)
+			break;
+	}
+	closedir(dir);
 
-	node_mask = 1UL << node;
+	if(node < 0)
+		goto err_node;
 
-	err = syscall(SYS_set_mempolicy, MPOL_BIND, &node_mask,
-		sizeof(unsigned long) * 8);
-	if(err < 0){
-		return -1;
+	return node;
+
+err_node:
+err_opendir:
+	return ufpd->numa_node;
+}
+
+static int ufpd_dev_node(struct ufpd *ufpd, int dev_idx)
+{
+	char path[FILENAME_MAX];
+	FILE *file;
+	int node;
+
+	snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/numa_node",
+		ufpd->ifnames[dev_idx]);
+	file = fopen(path, "r");
+	if(!file)
+		goto err_open;
+
+	if(fscanf(file, "%d", &node) != 1)
+		node = -1;
+	fclose(file);
+
+	/* Kernel reports -1 without NUMA */
+	if(node >= UFPD_MAX_NODES)
+		node = -1;
+
+	return node;
+
+err_open:
+	return -1;
+}
+
+static void ufpd_node_report(struct ufpd *ufpd)
+{
+	int i, j;
+
+	for(i = 0; i < ufpd->num_devices; i++){
+		for(j = 0; j < ufpd->num_threads; j++){
+			if(ufpd->dev_nodes[i] < 0
+			|| ufpd->dev_nodes[i] == ufpd->core_nodes[j])
+				continue;
+
+			ufpd_log(LOG_WARNING, "queue %d of %s on node %d"
+				" is served by core %u on node %d", j,
+				ufpd->ifnames[i], ufpd->dev_nodes[i],
+				ufpd->cores[j], ufpd->core_nodes[j]);
+		}
 	}
 
-	return 0;
+	return;
+}
+
+static struct ufp_mpool *ufpd_dev_mpool(struct ufpd *ufpd,
+	unsigned int thread_id, int dev_idx)
+{
+	int node;
+
+	/*
+	 * Remote node pools are only used at bring-up and tear-down,
+	 * both done by the main thread.
+	 */
+	node = ufpd->dev_nodes[dev_idx];
+	if(node < 0 || node == ufpd->core_nodes[thread_id])
+		return ufpd->mpools[thread_id];
+
+	return ufpd->mpools_node[node];
 }
 
 static int ufpd_parse_args(struct ufpd *ufpd, int argc, char **argv)
@@ -356,7 +657,7 @@ static int ufpd_parse_args(struct ufpd *ufpd, int argc, char **argv)
 			goto err_alloc_buf;
 	}
 
-	while((opt = getopt(argc, argv, "c:p:n:m:b:ah")) != -1){
+	while((opt = getopt(argc, argv, "c:p:n:M:m:b:asP:t:k:xh")) != -1){
 		switch(opt){
 		case 'c':
 			err = ufpd_parse_range(optarg,
@@ -397,6 +698,13 @@ static int ufpd_parse_args(struct ufpd *ufpd, int argc, char **argv)
 				goto err_arg;
 			}
 			break;
+		case 'M':
+			if(sscanf(optarg, "%lu", &ufpd->mpool_size) != 1
+			|| !ufpd->mpool_size){
+				printf("Invalid memory pool size\n");
+				goto err_arg;
+			}
+			break;
 		case 'm':
 			if(sscanf(optarg, "%u", &ufpd->mtu_frame) != 1){
 				printf("Invalid MTU length\n");
@@ -412,6 +720,51 @@ static int ufpd_parse_args(struct ufpd *ufpd, int argc, char **argv)
 		case 'a':
 			ufpd->promisc = 1;
 			break;
+		case 's':
+			ufpd->fib_shared = 1;
+			break;
+		case 'P':
+			err = ufpd_parse_range(optarg,
+				strbuf, sizeof(strbuf));
+			if(err < 0){
+				printf("Invalid argument\n");
+				goto err_arg;
+			}
+
+			ufpd->num_poll_cores = ufpd_parse_list(strbuf,
+				argbuf, UFPD_MAX_ARGLEN, UFPD_MAX_ARGS);
+			if(ufpd->num_poll_cores < 0){
+				printf("Invalid CPU cores to busy-poll\n");
+				goto err_arg;
+			}
+
+			err = ufpd_convert_list((const char **)argbuf,
+				ufpd->num_poll_cores,
+				"%u", ufpd->poll_cores,
+				sizeof(unsigned int), UFPD_MAX_CORES);
+			if(err < 0){
+				printf("Invalid argument\n");
+				goto err_arg;
+			}
+
+			ufpd->num_poll_cores = min(ufpd->num_poll_cores,
+				(unsigned int)UFPD_MAX_CORES);
+			break;
+		case 't':
+			if(sscanf(optarg, "%u", &ufpd->adapt_threshold) != 1){
+				printf("Invalid RX burst threshold\n");
+				goto err_arg;
+			}
+			break;
+		case 'k':
+			if(sscanf(optarg, "%u", &ufpd->adapt_idle) != 1){
+				printf("Invalid number of empty polls\n");
+				goto err_arg;
+			}
+			break;
+		case 'x':
+			ufpd->no_tx_irq = 1;
+			break;
 		case 'h':
 			usage();
 			goto err_arg;
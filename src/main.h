@@ -31,6 +31,9 @@
 #define UFPD_MAX_ARGS 128
 #define UFPD_MAX_ARGLEN 1024
 #define UFPD_MAX_IFS 64
+#define UFPD_ADAPT_IDLE 8
+#define UFPD_MPOOL_SIZE 1024 /* MB */
+#define UFPD_MAX_NODES 8
 
 struct ufpd {
 	struct ufp_dev		**devs;
@@ -44,6 +47,21 @@ struct ufpd {
 	unsigned int		buf_size;
 	unsigned int		buf_count;
 	unsigned int		numa_node;
+	unsigned long		mpool_size;
+	int			core_nodes[UFPD_MAX_CORES];
+	int			dev_nodes[UFPD_MAX_IFS]; /* -1 if unknown */
+	struct ufp_mpool	*mpools_node[UFPD_MAX_NODES]; /* for devices */
+	unsigned int		fib_shared;
+	unsigned int		poll_cores[UFPD_MAX_CORES];
+	unsigned int		num_poll_cores;
+	unsigned int		adapt_threshold;
+	unsigned int		adapt_idle;
+	unsigned int		no_tx_irq;
+	struct ufp_mpool	*mpool_ctrl;
+	struct rcu		*rcu;
+	struct fib		*fib_inet;
+	struct fib		*fib_inet6;
+	struct control_ring	**rings;
 };
 
 void ufpd_log(int level, char *fmt, ...);
@@ -10,14 +10,6 @@
 #include "main.h"
 #include "neigh.h"
 
-static void neigh_entry_delete(struct hash_entry *entry);
-static unsigned int neigh_key_generate_v4(void *key,
-	unsigned int bit_len);
-static unsigned int neigh_key_generate_v6(void *key,
-	unsigned int bit_len);
-static int neigh_key_compare_v4(void *key_tgt, void *key_ent);
-static int neigh_key_compare_v6(void *key_tgt, void *key_ent);
-
 #ifdef DEBUG
 static void neigh_add_print(int family,
 	void *dst_addr, void *mac_addr);
@@ -89,34 +81,32 @@ static void neigh_delete_print(int family,
 struct neigh_table *neigh_alloc(struct ufp_mpool *mpool, int family)
 {
 	struct neigh_table *neigh;
+	unsigned int key_len;
 
 	neigh = ufp_mem_alloc(mpool, sizeof(struct neigh_table));
 	if(!neigh)
 		goto err_neigh_alloc;
 
-	hash_init(&neigh->table);
-	neigh->table.hash_entry_delete = neigh_entry_delete;
-
 	switch(family){
 	case AF_INET:
-		neigh->table.hash_key_generate =
-			neigh_key_generate_v4;
-		neigh->table.hash_key_compare =
-			neigh_key_compare_v4;
+		key_len = 4;
 		break;
 	case AF_INET6:
-		neigh->table.hash_key_generate =
-			neigh_key_generate_v6;
-		neigh->table.hash_key_compare =
-			neigh_key_compare_v6;
+		key_len = 16;
 		break;
 	default:
 		goto err_invalid_family;
 		break;
 	}
 
+	neigh->table = cuckoo_alloc(mpool, key_len,
+		sizeof(struct neigh_entry));
+	if(!neigh->table)
+		goto err_table_alloc;
+
 	return neigh;
 
+err_table_alloc:
 err_invalid_family:
 	ufp_mem_free(neigh);
 err_neigh_alloc:
@@ -125,87 +115,29 @@ err_neigh_alloc:
 
 void neigh_release(struct neigh_table *neigh)
 {
-	hash_delete_all(&neigh->table);
+	cuckoo_release(neigh->table);
 	ufp_mem_free(neigh);
 	return;
 }
 
-static void neigh_entry_delete(struct hash_entry *entry)
-{
-	struct neigh_entry *neigh_entry;
-
-	neigh_entry = hash_entry(entry, struct neigh_entry, hash);
-	ufp_mem_free(neigh_entry);
-	return;
-}
-
-static unsigned int neigh_key_generate_v4(void *key, unsigned int bit_len)
-{
-	/* On some cpus multiply is faster, on others gcc will do shifts */
-	uint32_t hash = *((uint32_t *)key) * GOLDEN_RATIO_PRIME_32;
-
-	/* High bits are more random, so use them. */
-	return hash >> (32 - bit_len);
-}
-
-static unsigned int neigh_key_generate_v6(void *key, unsigned int bit_len)
-{
-	uint64_t hash = ((uint64_t *)key)[0] * ((uint64_t *)key)[1];
-	hash *= GOLDEN_RATIO_PRIME_64;
-
-	return hash >> (64 - bit_len);
-}
-
-static int neigh_key_compare_v4(void *key_tgt, void *key_ent)
-{
-	return ((uint32_t *)key_tgt)[0] ^ ((uint32_t *)key_ent)[0] ?
-		1 : 0;
-}
-
-static int neigh_key_compare_v6(void *key_tgt, void *key_ent)
-{
-	return ((uint64_t *)key_tgt)[0] ^ ((uint64_t *)key_ent)[0] ?
-		1 : (((uint64_t *)key_tgt)[1] ^ ((uint64_t *)key_ent)[1] ?
-		1 : 0);
-}
-
 int neigh_add(struct neigh_table *neigh, int family,
-	void *dst_addr, void *mac_addr, struct ufp_mpool *mpool)
+	void *dst_addr, void *mac_addr)
 {
 	struct neigh_entry *neigh_entry;
-	int ret;
-
-	neigh_entry = ufp_mem_alloc(mpool, sizeof(struct neigh_entry));
-	if(!neigh_entry)
-		goto err_alloc_entry;
-
-	memcpy(neigh_entry->dst_mac, mac_addr, ETH_ALEN);
-	switch(family){
-	case AF_INET:
-		memcpy(neigh_entry->dst_addr, dst_addr, 4);
-		break;
-	case AF_INET6:
-		memcpy(neigh_entry->dst_addr, dst_addr, 16);
-		break;
-	default:
-		goto err_invalid_family;
-		break;
-	}
 
 #ifdef DEBUG
 	neigh_add_print(family, dst_addr, mac_addr);
 #endif
 
-	ret = hash_add(&neigh->table, neigh_entry->dst_addr, &neigh_entry->hash);
-	if(ret < 0)
-		goto err_hash_add;
+	/* Known neighbor is updated in place */
+	neigh_entry = cuckoo_add(neigh->table, dst_addr);
+	if(!neigh_entry)
+		goto err_cuckoo_add;
 
+	memcpy(neigh_entry->dst_mac, mac_addr, ETH_ALEN);
 	return 0;
 
-err_hash_add:
-err_invalid_family:
-	ufp_mem_free(neigh_entry);
-err_alloc_entry:
+err_cuckoo_add:
 	return -1;
 }
 
@@ -218,29 +150,39 @@ int neigh_delete(struct neigh_table *neigh, int family,
 	neigh_delete_print(family, dst_addr);
 #endif
 
-	ret = hash_delete(&neigh->table, dst_addr);
+	ret = cuckoo_delete(neigh->table, dst_addr);
 	if(ret < 0)
-		goto err_hash_delete;
+		goto err_cuckoo_delete;
 
 	return 0;
 
-err_hash_delete:
+err_cuckoo_delete:
 	return -1;
 }
 
 struct neigh_entry *neigh_lookup(struct neigh_table *neigh,
 	void *dst_addr)
 {
-	struct hash_entry *hash_entry;
-	struct neigh_entry *neigh_entry;
+	return cuckoo_lookup(neigh->table, dst_addr);
+}
 
-	hash_entry = hash_lookup(&neigh->table, dst_addr);
-	if(!hash_entry)
-		goto err_hash_lookup;
+void neigh_lookup_bulk(struct neigh_table **neigh, void **dst_addr,
+	struct neigh_entry **entry, int num)
+{
+	struct cuckoo_table *table[CUCKOO_LOOKUP_BULK];
+	int base, n, i;
 
-	neigh_entry = hash_entry(hash_entry, struct neigh_entry, hash);
-	return neigh_entry;
+	for(base = 0; base < num; base += CUCKOO_LOOKUP_BULK){
+		n = min(num - base, CUCKOO_LOOKUP_BULK);
 
-err_hash_lookup:
-	return NULL;
+		for(i = 0; i < n; i++){
+			table[i] = neigh[base + i] ?
+				neigh[base + i]->table : NULL;
+		}
+
+		cuckoo_lookup_bulk(table, &dst_addr[base],
+			(void **)&entry[base], n);
+	}
+
+	return;
 }
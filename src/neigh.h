@@ -4,28 +4,27 @@
 #include <linux/if_ether.h>
 #include <pthread.h>
 #include <ufp.h>
-#include "hash.h"
-
-#define GOLDEN_RATIO_PRIME_32 0x9e370001UL
-#define GOLDEN_RATIO_PRIME_64 0x9e37fffffffc0001UL
+#include "cuckoo.h"
 
 struct neigh_table {
-	struct hash_table	table;
+	struct cuckoo_table	*table;
 };
 
+/* Stored inline in cuckoo table, key comes first */
 struct neigh_entry {
-	struct hash_entry	hash;
-	uint8_t			dst_mac[ETH_ALEN];
 	uint32_t		dst_addr[4];
+	uint8_t			dst_mac[ETH_ALEN];
 };
 
 struct neigh_table *neigh_alloc(struct ufp_mpool *mpool, int family);
 void neigh_release(struct neigh_table *neigh);
 int neigh_add(struct neigh_table *neigh, int family,
-	void *dst_addr, void *mac_addr, struct ufp_mpool *mpool);
+	void *dst_addr, void *mac_addr);
 int neigh_delete(struct neigh_table *neigh, int family,
 	void *dst_addr);
 struct neigh_entry *neigh_lookup(struct neigh_table *neigh,
 	void *dst_addr);
+void neigh_lookup_bulk(struct neigh_table **neigh, void **dst_addr,
+	struct neigh_entry **entry, int num);
 
 #endif /* _UFPD_NEIGH_H */
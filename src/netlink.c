@@ -7,19 +7,22 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <syslog.h>
-#include <linux/if_ether.h>
 #include <ufp.h>
 
 #include "main.h"
-#include "thread.h"
+#include "control.h"
 #include "netlink.h"
 #include "fib.h"
-#include "neigh.h"
 
-static void netlink_route(struct ufpd_thread *thread, struct nlmsghdr *nlh);
-static void netlink_neigh(struct ufpd_thread *thread, struct nlmsghdr *nlh);
+static void netlink_route(struct ufpd_control *control,
+	struct nlmsghdr *nlh);
+static void netlink_neigh(struct ufpd_control *control,
+	struct nlmsghdr *nlh);
+static void netlink_route_multipath(struct ufpd_control *control,
+	struct control_msg *msg, struct rtattr *route_attr);
+static int netlink_port_index(struct ufpd_control *control, int ifindex);
 
-void netlink_process(struct ufpd_thread *thread,
+void netlink_process(struct ufpd_control *control,
 	uint8_t *read_buf, int read_size)
 {
 	struct nlmsghdr *nlh;
@@ -30,11 +33,11 @@ void netlink_process(struct ufpd_thread *thread,
 		switch(nlh->nlmsg_type){
 		case RTM_NEWROUTE:
 		case RTM_DELROUTE:
-			netlink_route(thread, nlh);
+			netlink_route(control, nlh);
 			break;
 		case RTM_NEWNEIGH:
 		case RTM_DELNEIGH:
-			netlink_neigh(thread, nlh);
+			netlink_neigh(control, nlh);
 			break;
 		default:
 			ufpd_log(LOG_ERR, "unknown type netlink message");
@@ -47,24 +50,34 @@ void netlink_process(struct ufpd_thread *thread,
 	return;
 }
 
-static void netlink_route(struct ufpd_thread *thread, struct nlmsghdr *nlh)
+static void netlink_route(struct ufpd_control *control,
+	struct nlmsghdr *nlh)
 {
 	struct rtmsg *route_entry;
 	struct rtattr *route_attr;
-	struct fib *fib;
-	int route_attr_len, family;
-	uint8_t prefix[16] = {};
-	uint8_t nexthop[16] = {};
-	unsigned int prefix_len;
-	int ifindex, port_index, i;
-	enum fib_type type;
+	struct control_msg msg;
+	int route_attr_len;
+	int ifindex;
 
 	route_entry = (struct rtmsg *)NLMSG_DATA(nlh);
-	family		= route_entry->rtm_family;
-	prefix_len	= route_entry->rtm_dst_len;
-	ifindex		= -1;
-	port_index	= -1;
-	type		= FIB_TYPE_LINK;
+	ifindex = -1;
+
+	switch(route_entry->rtm_family){
+	case AF_INET:
+	case AF_INET6:
+		break;
+	default:
+		goto out;
+		break;
+	}
+
+	memset(&msg, 0, sizeof(struct control_msg));
+	msg.type	= (nlh->nlmsg_type == RTM_NEWROUTE) ?
+		CONTROL_ROUTE_UPDATE : CONTROL_ROUTE_DELETE;
+	msg.family	= route_entry->rtm_family;
+	msg.prefix_len	= route_entry->rtm_dst_len;
+	msg.fib_type	= FIB_TYPE_LINK;
+	msg.replace	= (nlh->nlmsg_flags & NLM_F_REPLACE) ? 1 : 0;
 
 	route_attr = (struct rtattr *)RTM_RTA(route_entry);
 	route_attr_len = RTM_PAYLOAD(nlh);
@@ -72,17 +85,22 @@ static void netlink_route(struct ufpd_thread *thread, struct nlmsghdr *nlh)
 	while(RTA_OK(route_attr, route_attr_len)){
 		switch(route_attr->rta_type){
 		case RTA_DST:
-			memcpy(prefix, RTA_DATA(route_attr),
-				RTA_PAYLOAD(route_attr));
+			memcpy(msg.addr, RTA_DATA(route_attr),
+				min((size_t)RTA_PAYLOAD(route_attr),
+				sizeof(msg.addr)));
 			break;
 		case RTA_GATEWAY:
-			memcpy(nexthop, RTA_DATA(route_attr),
-				RTA_PAYLOAD(route_attr));
-			type = FIB_TYPE_FORWARD;
+			memcpy(msg.nexthops[0].addr, RTA_DATA(route_attr),
+				min((size_t)RTA_PAYLOAD(route_attr),
+				sizeof(msg.nexthops[0].addr)));
+			msg.fib_type = FIB_TYPE_FORWARD;
 			break;
 		case RTA_OIF:
 			ifindex = *(int *)RTA_DATA(route_attr);
 			break;
+		case RTA_MULTIPATH:
+			netlink_route_multipath(control, &msg, route_attr);
+			break;
 		default:
 			break;
 		}
@@ -91,70 +109,51 @@ static void netlink_route(struct ufpd_thread *thread, struct nlmsghdr *nlh)
 	}
 
 	if(route_entry->rtm_table == RT_TABLE_LOCAL)
-		type = FIB_TYPE_LOCAL;
-
-	for(i = 0; i < thread->num_ports; i++){
-		if(ufp_tun_index(thread->plane, i) == ifindex){
-			port_index = i;
-			break;
-		}
+		msg.fib_type = FIB_TYPE_LOCAL;
+
+	/* Single path route */
+	if(!msg.num_nexthops){
+		msg.nexthops[0].port_index =
+			netlink_port_index(control, ifindex);
+		msg.nexthops[0].weight = 1;
+		msg.num_nexthops = 1;
 	}
+	msg.id = ifindex;
 
-	switch(family){
-	case AF_INET:
-		fib = thread->fib_inet;
-		break;
-	case AF_INET6:
-		fib = thread->fib_inet6;
-		break;
-	default:
-		goto out;
-		break;
-	}
-
-	switch(nlh->nlmsg_type){
-	case RTM_NEWROUTE:
-		fib_route_update(fib, family, type,
-			prefix, prefix_len, nexthop, port_index, ifindex,
-			thread->mpool);
-		break;
-	case RTM_DELROUTE:
-		fib_route_delete(fib, family,
-			prefix, prefix_len, ifindex);
-		break;
-	default:
-		break;
-	}
+	control_dispatch(control, &msg);
 
 out:
 	return;
 }
 
-static void netlink_neigh(struct ufpd_thread *thread, struct nlmsghdr *nlh)
+static void netlink_neigh(struct ufpd_control *control,
+	struct nlmsghdr *nlh)
 {
 	struct ndmsg *neigh_entry;
 	struct rtattr *route_attr;
-	struct neigh_table *neigh;
+	struct control_msg msg;
 	int route_attr_len;
-	int ifindex;
-	int family;
-	uint8_t dst_addr[16] = {};
-	uint8_t dst_mac[ETH_ALEN] = {};
-	int i, port_index = -1;
 
 	neigh_entry = (struct ndmsg *)NLMSG_DATA(nlh);
-	family		= neigh_entry->ndm_family;
-	ifindex		= neigh_entry->ndm_ifindex;
-	port_index 	= -1;
 
-	for(i = 0; i < thread->num_ports; i++){
-		if(ufp_tun_index(thread->plane, i) == ifindex){
-			port_index = i;
-			break;
-		}
+	switch(neigh_entry->ndm_family){
+	case AF_INET:
+	case AF_INET6:
+		break;
+	default:
+		goto out;
+		break;
 	}
 
-	if(port_index < 0)
+	memset(&msg, 0, sizeof(struct control_msg));
+	msg.type	= (nlh->nlmsg_type == RTM_NEWNEIGH) ?
+		CONTROL_NEIGH_ADD : CONTROL_NEIGH_DELETE;
+	msg.family	= neigh_entry->ndm_family;
+	msg.port_index	= netlink_port_index(control,
+		neigh_entry->ndm_ifindex);
+	msg.id		= neigh_entry->ndm_ifindex;
+
+	if(msg.port_index < 0)
 		goto out;
 
 	route_attr = (struct rtattr *)RTM_RTA(neigh_entry);
@@ -163,12 +162,14 @@ static void netlink_neigh(struct ufpd_thread *thread, struct nlmsghdr *nlh)
 	while(RTA_OK(route_attr, route_attr_len)){
 		switch(route_attr->rta_type){
 		case NDA_DST:
-			memcpy(dst_addr, RTA_DATA(route_attr),
-				RTA_PAYLOAD(route_attr));
+			memcpy(msg.addr, RTA_DATA(route_attr),
+				min((size_t)RTA_PAYLOAD(route_attr),
+				sizeof(msg.addr)));
 			break;
 		case NDA_LLADDR:
-			memcpy(dst_mac, RTA_DATA(route_attr),
-				RTA_PAYLOAD(route_attr));
+			memcpy(msg.mac, RTA_DATA(route_attr),
+				min((size_t)RTA_PAYLOAD(route_attr),
+				sizeof(msg.mac)));
 			break;
 		default:
 			break;
@@ -177,30 +178,67 @@ static void netlink_neigh(struct ufpd_thread *thread, struct nlmsghdr *nlh)
 		route_attr = RTA_NEXT(route_attr, route_attr_len);
 	}
 
-	switch(family){
-	case AF_INET:
-		neigh = thread->neigh_inet[port_index];
-		break;
-	case AF_INET6:
-		neigh = thread->neigh_inet6[port_index];
-		break;
-	default:
-		goto out;
-		break;
+	control_dispatch(control, &msg);
+
+out:
+	return;
+}
+
+static void netlink_route_multipath(struct ufpd_control *control,
+	struct control_msg *msg, struct rtattr *route_attr)
+{
+	struct rtnexthop *rtnh;
+	struct rtattr *nh_attr;
+	struct fib_nexthop *nexthop;
+	int rtnh_len, nh_attr_len;
+
+	rtnh = (struct rtnexthop *)RTA_DATA(route_attr);
+	rtnh_len = RTA_PAYLOAD(route_attr);
+
+	while(RTNH_OK(rtnh, rtnh_len)
+	&& msg->num_nexthops < FIB_MULTIPATH_MAX){
+		nexthop = &msg->nexthops[msg->num_nexthops++];
+		nexthop->port_index = netlink_port_index(control,
+			rtnh->rtnh_ifindex);
+		/* rtnh_hops holds weight - 1 */
+		nexthop->weight = rtnh->rtnh_hops + 1;
+
+		nh_attr = RTNH_DATA(rtnh);
+		nh_attr_len = rtnh->rtnh_len - RTNH_LENGTH(0);
+
+		while(RTA_OK(nh_attr, nh_attr_len)){
+			if(nh_attr->rta_type == RTA_GATEWAY){
+				memcpy(nexthop->addr, RTA_DATA(nh_attr),
+					min((size_t)RTA_PAYLOAD(nh_attr),
+					sizeof(nexthop->addr)));
+				msg->fib_type = FIB_TYPE_FORWARD;
+			}
+
+			nh_attr = RTA_NEXT(nh_attr, nh_attr_len);
+		}
+
+		rtnh_len -= RTNH_ALIGN(rtnh->rtnh_len);
+		rtnh = RTNH_NEXT(rtnh);
 	}
 
-	switch(nlh->nlmsg_type){
-	case RTM_NEWNEIGH:
-		neigh_add(neigh, family, dst_addr, dst_mac,
-			thread->mpool);
-		break;
-	case RTM_DELNEIGH:
-		neigh_delete(neigh, family, dst_addr);
-		break;
-	default:
-		break;
+	/* Remaining nexthops do not get any traffic */
+	if(RTNH_OK(rtnh, rtnh_len)){
+		ufpd_log(LOG_WARNING,
+			"multipath route truncated to %d nexthops",
+			FIB_MULTIPATH_MAX);
 	}
 
-out:
 	return;
 }
+
+static int netlink_port_index(struct ufpd_control *control, int ifindex)
+{
+	int i;
+
+	for(i = 0; i < control->num_ports; i++){
+		if(ufp_tun_index(control->plane, i) == ifindex)
+			return i;
+	}
+
+	return -1;
+}
@@ -2,8 +2,9 @@
 #define _UFPD_NETLINK_H
 
 #include "main.h"
+#include "control.h"
 
-void netlink_process(struct ufpd_thread *thread,
+void netlink_process(struct ufpd_control *control,
 	uint8_t *read_buf, int read_size);
 
 #endif /* _UFPD_NETLINK_H */
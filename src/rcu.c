@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sched.h>
+#include <stddef.h>
+#include <ufp.h>
+
+#include "main.h"
+#include "rcu.h"
+
+static uint64_t rcu_epoch_min(struct rcu *rcu);
+static void rcu_synchronize(struct rcu *rcu, uint64_t epoch);
+
+struct rcu *rcu_alloc(unsigned int num_readers)
+{
+	struct rcu *rcu;
+	int i, ret;
+
+	rcu = malloc(sizeof(struct rcu));
+	if(!rcu)
+		goto err_rcu_alloc;
+
+	/* Readers are written by each thread, avoid false sharing */
+	ret = posix_memalign((void **)&rcu->readers, 64,
+		sizeof(struct rcu_reader) * num_readers);
+	if(ret != 0)
+		goto err_readers_alloc;
+
+	for(i = 0; i < num_readers; i++){
+		rcu->readers[i].epoch = 0;
+		rcu->readers[i].rcu = rcu;
+	}
+
+	/* Epoch 0 is reserved for offline readers */
+	rcu->epoch = 1;
+	rcu->num_readers = num_readers;
+	list_init(&rcu->defer);
+
+	return rcu;
+
+err_readers_alloc:
+	free(rcu);
+err_rcu_alloc:
+	return NULL;
+}
+
+void rcu_release(struct rcu *rcu)
+{
+	rcu_flush(rcu);
+	free(rcu->readers);
+	free(rcu);
+	return;
+}
+
+static uint64_t rcu_epoch_min(struct rcu *rcu)
+{
+	uint64_t epoch, epoch_min;
+	int i;
+
+	/* Pairs with the barrier in rcu_online() */
+	__sync_synchronize();
+
+	epoch_min = UINT64_MAX;
+	for(i = 0; i < rcu->num_readers; i++){
+		epoch = rcu->readers[i].epoch;
+		if(epoch && epoch < epoch_min)
+			epoch_min = epoch;
+	}
+
+	return epoch_min;
+}
+
+static void rcu_synchronize(struct rcu *rcu, uint64_t epoch)
+{
+	while(rcu_epoch_min(rcu) <= epoch){
+		sched_yield();
+	}
+
+	return;
+}
+
+void rcu_defer(struct rcu *rcu, void (*func)(void *, void *),
+	void *arg, void *ptr)
+{
+	struct rcu_defer *defer;
+	uint64_t epoch;
+
+	/* Private table has no reader other than the updater */
+	if(!rcu){
+		func(arg, ptr);
+		goto out;
+	}
+
+	epoch = rcu->epoch;
+	rcu->epoch = epoch + 1;
+
+	defer = malloc(sizeof(struct rcu_defer));
+	if(!defer){
+		rcu_synchronize(rcu, epoch);
+		func(arg, ptr);
+		goto out;
+	}
+
+	defer->epoch	= epoch;
+	defer->func	= func;
+	defer->arg	= arg;
+	defer->ptr	= ptr;
+	list_add_last(&rcu->defer, &defer->list);
+
+out:
+	return;
+}
+
+void rcu_reclaim(struct rcu *rcu)
+{
+	struct rcu_defer *defer, *temp;
+	uint64_t epoch_min;
+
+	epoch_min = rcu_epoch_min(rcu);
+
+	/* Deferred objects are queued in order of epoch */
+	list_for_each_safe(&rcu->defer, defer, list, temp){
+		if(defer->epoch >= epoch_min)
+			break;
+
+		list_del(&defer->list);
+		defer->func(defer->arg, defer->ptr);
+		free(defer);
+	}
+
+	return;
+}
+
+void rcu_flush(struct rcu *rcu)
+{
+	struct rcu_defer *defer, *temp;
+
+	/* Caller guarantees that no reader remains */
+	list_for_each_safe(&rcu->defer, defer, list, temp){
+		list_del(&defer->list);
+		defer->func(defer->arg, defer->ptr);
+		free(defer);
+	}
+
+	return;
+}
@@ -0,0 +1,70 @@
+#ifndef _UFPD_RCU_H
+#define _UFPD_RCU_H
+
+#include <stdint.h>
+#include <ufp.h>
+#include "main.h"
+
+/* Let the interval short enough to bound memory of deferred objects */
+#define RCU_RECLAIM_INTERVAL 10 /* ms */
+
+#define rcu_assign_pointer(p, v) ({		\
+	asm volatile("" ::: "memory");		\
+	(p) = (v); })
+
+/*
+ * Epoch based reclamation:
+ * Reader publishes the global epoch it observed while it may hold
+ * references, and 0 while it is offline (e.g. sleeping in epoll_wait).
+ * Objects retired at epoch E are freed once every online reader
+ * has observed an epoch newer than E.
+ */
+struct rcu_reader {
+	volatile uint64_t	epoch;
+	struct rcu		*rcu;
+} __attribute__ ((aligned(64)));
+
+struct rcu_defer {
+	struct list_node	list;
+	uint64_t		epoch;
+	void			(*func)(void *, void *);
+	void			*arg;
+	void			*ptr;
+};
+
+struct rcu {
+	volatile uint64_t	epoch;
+	struct rcu_reader	*readers;
+	unsigned int		num_readers;
+	struct list_head	defer;
+};
+
+struct rcu *rcu_alloc(unsigned int num_readers);
+void rcu_release(struct rcu *rcu);
+void rcu_defer(struct rcu *rcu, void (*func)(void *, void *),
+	void *arg, void *ptr);
+void rcu_reclaim(struct rcu *rcu);
+void rcu_flush(struct rcu *rcu);
+
+static inline int rcu_pending(struct rcu *rcu)
+{
+	return !list_empty(&rcu->defer);
+}
+
+static inline void rcu_online(struct rcu_reader *reader)
+{
+	reader->epoch = reader->rcu->epoch;
+
+	/* Epoch must be visible before any reference is taken */
+	__sync_synchronize();
+	return;
+}
+
+static inline void rcu_offline(struct rcu_reader *reader)
+{
+	asm volatile("" ::: "memory");
+	reader->epoch = 0;
+	return;
+}
+
+#endif /* _UFPD_RCU_H */
@@ -0,0 +1,562 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <ufp.h>
+
+#include "main.h"
+#include "tbm.h"
+
+static unsigned int tbm_pos(unsigned __int128 addr, unsigned int depth,
+	unsigned int len);
+static void tbm_reclaim(void *arg, void *ptr);
+static void tbm_free(struct tbm_table *table, void *ptr);
+static int tbm_publish(struct tbm_table *table, struct tbm_node **slot,
+	unsigned int num, unsigned int rank, struct tbm_node *node);
+static struct tbm_node *tbm_child_insert(struct tbm_table *table,
+	struct tbm_node *node, unsigned int bits);
+static int tbm_child_remove(struct tbm_table *table,
+	struct tbm_node *node, unsigned int bits);
+static int tbm_result_insert(struct tbm_table *table,
+	struct tbm_node *node, unsigned int pos, uint32_t index);
+static int tbm_result_remove(struct tbm_table *table,
+	struct tbm_node *node, unsigned int pos);
+static int tbm_chain_build(struct tbm_table *table, struct tbm_node *node,
+	unsigned __int128 addr, unsigned int depth,
+	unsigned int prefix_len, uint32_t index);
+static void _tbm_release(struct tbm_node *node);
+
+struct tbm_table *tbm_alloc(struct ufp_mpool *mpool, struct rcu *rcu)
+{
+	struct tbm_table *table;
+	unsigned int bits, len;
+
+	table = ufp_mem_alloc(mpool, sizeof(struct tbm_table));
+	if(!table)
+		goto err_table_alloc;
+
+	table->root = ufp_mem_alloc(mpool, sizeof(struct tbm_node));
+	if(!table->root)
+		goto err_root_alloc;
+
+	memset(table->root, 0, sizeof(struct tbm_node));
+	table->mpool = mpool;
+	table->rcu = rcu;
+
+	/* Positions of every prefix in a node which can match the index */
+	for(bits = 0; bits < TBM_NODE_SIZE; bits++){
+		table->mask[bits] = 0;
+		for(len = 0; len < TBM_STRIDE; len++){
+			table->mask[bits] |= 1ULL <<
+				((1 << len) - 1 + (bits >> (TBM_STRIDE - len)));
+		}
+	}
+
+	return table;
+
+err_root_alloc:
+	ufp_mem_free(table);
+err_table_alloc:
+	return NULL;
+}
+
+void tbm_release(struct tbm_table *table)
+{
+	_tbm_release(table->root);
+	ufp_mem_free(table->root);
+	ufp_mem_free(table);
+	return;
+}
+
+static void _tbm_release(struct tbm_node *node)
+{
+	int i;
+
+	for(i = 0; i < tbm_popcount(node->children); i++){
+		_tbm_release(&node->child[i]);
+	}
+
+	if(node->child)
+		ufp_mem_free(node->child);
+
+	if(node->result)
+		ufp_mem_free(node->result);
+
+	return;
+}
+
+static unsigned int tbm_pos(unsigned __int128 addr, unsigned int depth,
+	unsigned int len)
+{
+	return (1 << len) - 1
+		+ (tbm_index(addr, depth) >> (TBM_STRIDE - len));
+}
+
+static void tbm_reclaim(void *arg, void *ptr)
+{
+	ufp_mem_free(ptr);
+	return;
+}
+
+static void tbm_free(struct tbm_table *table, void *ptr)
+{
+	if(ptr)
+		rcu_defer(table->rcu, tbm_reclaim, table, ptr);
+
+	return;
+}
+
+/*
+ * Published nodes are never modified except results.
+ * Updated node is copied into a new array of its siblings and
+ * made visible by a single store to the pointer of its parent.
+ */
+static int tbm_publish(struct tbm_table *table, struct tbm_node **slot,
+	unsigned int num, unsigned int rank, struct tbm_node *node)
+{
+	struct tbm_node *array, *array_old;
+
+	array = ufp_mem_alloc(table->mpool, sizeof(struct tbm_node) * num);
+	if(!array)
+		goto err_alloc_array;
+
+	array_old = *slot;
+	memcpy(array, array_old, sizeof(struct tbm_node) * num);
+	array[rank] = *node;
+
+	rcu_assign_pointer(*slot, array);
+	tbm_free(table, array_old);
+
+	return 0;
+
+err_alloc_array:
+	return -1;
+}
+
+static struct tbm_node *tbm_child_insert(struct tbm_table *table,
+	struct tbm_node *node, unsigned int bits)
+{
+	struct tbm_node *child;
+	unsigned int num, rank;
+
+	num = tbm_popcount(node->children);
+	rank = tbm_rank(node->children, bits);
+
+	child = ufp_mem_alloc(table->mpool,
+		sizeof(struct tbm_node) * (num + 1));
+	if(!child)
+		goto err_alloc_child;
+
+	memcpy(child, node->child, sizeof(struct tbm_node) * rank);
+	memset(&child[rank], 0, sizeof(struct tbm_node));
+	memcpy(&child[rank + 1], &node->child[rank],
+		sizeof(struct tbm_node) * (num - rank));
+
+	node->child = child;
+	node->children |= 1ULL << bits;
+
+	return &child[rank];
+
+err_alloc_child:
+	return NULL;
+}
+
+static int tbm_child_remove(struct tbm_table *table,
+	struct tbm_node *node, unsigned int bits)
+{
+	struct tbm_node *child;
+	unsigned int num, rank;
+
+	num = tbm_popcount(node->children);
+	rank = tbm_rank(node->children, bits);
+
+	child = NULL;
+	if(num > 1){
+		child = ufp_mem_alloc(table->mpool,
+			sizeof(struct tbm_node) * (num - 1));
+		if(!child)
+			goto err_alloc_child;
+
+		memcpy(child, node->child, sizeof(struct tbm_node) * rank);
+		memcpy(&child[rank], &node->child[rank + 1],
+			sizeof(struct tbm_node) * (num - rank - 1));
+	}
+
+	node->child = child;
+	node->children &= ~(1ULL << bits);
+
+	return 0;
+
+err_alloc_child:
+	return -1;
+}
+
+static int tbm_result_insert(struct tbm_table *table,
+	struct tbm_node *node, unsigned int pos, uint32_t index)
+{
+	uint32_t *result;
+	unsigned int num, rank;
+
+	num = tbm_popcount(node->prefixes);
+	rank = tbm_rank(node->prefixes, pos);
+
+	result = ufp_mem_alloc(table->mpool,
+		sizeof(uint32_t) * (num + 1));
+	if(!result)
+		goto err_alloc_result;
+
+	memcpy(result, node->result, sizeof(uint32_t) * rank);
+	result[rank] = index;
+	memcpy(&result[rank + 1], &node->result[rank],
+		sizeof(uint32_t) * (num - rank));
+
+	node->result = result;
+	node->prefixes |= 1ULL << pos;
+
+	return 0;
+
+err_alloc_result:
+	return -1;
+}
+
+static int tbm_result_remove(struct tbm_table *table,
+	struct tbm_node *node, unsigned int pos)
+{
+	uint32_t *result;
+	unsigned int num, rank;
+
+	num = tbm_popcount(node->prefixes);
+	rank = tbm_rank(node->prefixes, pos);
+
+	result = NULL;
+	if(num > 1){
+		result = ufp_mem_alloc(table->mpool,
+			sizeof(uint32_t) * (num - 1));
+		if(!result)
+			goto err_alloc_result;
+
+		memcpy(result, node->result, sizeof(uint32_t) * rank);
+		memcpy(&result[rank], &node->result[rank + 1],
+			sizeof(uint32_t) * (num - rank - 1));
+	}
+
+	node->result = result;
+	node->prefixes &= ~(1ULL << pos);
+
+	return 0;
+
+err_alloc_result:
+	return -1;
+}
+
+/* Build a path of new nodes which is not visible yet */
+static int tbm_chain_build(struct tbm_table *table, struct tbm_node *node,
+	unsigned __int128 addr, unsigned int depth,
+	unsigned int prefix_len, uint32_t index)
+{
+	struct tbm_node *child;
+
+	for(; prefix_len - depth >= TBM_STRIDE; depth += TBM_STRIDE){
+		child = ufp_mem_alloc(table->mpool, sizeof(struct tbm_node));
+		if(!child)
+			goto err_alloc_child;
+
+		memset(child, 0, sizeof(struct tbm_node));
+		node->child = child;
+		node->children = 1ULL << tbm_index(addr, depth);
+		node = child;
+	}
+
+	node->result = ufp_mem_alloc(table->mpool, sizeof(uint32_t));
+	if(!node->result)
+		goto err_alloc_result;
+
+	node->result[0] = index;
+	node->prefixes = 1ULL << tbm_pos(addr, depth, prefix_len - depth);
+
+	return 0;
+
+err_alloc_result:
+err_alloc_child:
+	return -1;
+}
+
+int tbm_add(struct tbm_table *table, void *prefix,
+	unsigned int prefix_len, uint32_t index)
+{
+	struct tbm_node **slot, *node, *child, node_new;
+	unsigned __int128 addr;
+	unsigned int depth, bits, pos, num, rank;
+	void *retire;
+	int ret;
+
+	addr = tbm_addr(prefix);
+	bits = 0;
+	slot = &table->root;
+	num = 1;
+	rank = 0;
+	node = table->root;
+
+	/* Walk down while the path exists */
+	for(depth = 0; prefix_len - depth >= TBM_STRIDE;
+	depth += TBM_STRIDE){
+		bits = tbm_index(addr, depth);
+		if(!(node->children & (1ULL << bits)))
+			break;
+
+		slot = &node->child;
+		num = tbm_popcount(node->children);
+		rank = tbm_rank(node->children, bits);
+		node = &node->child[rank];
+	}
+
+	node_new = *node;
+
+	if(prefix_len - depth < TBM_STRIDE){
+		pos = tbm_pos(addr, depth, prefix_len - depth);
+
+		/* Replacing existing result is a single store */
+		if(node->prefixes & (1ULL << pos)){
+			node->result[tbm_rank(node->prefixes, pos)] = index;
+			goto out;
+		}
+
+		ret = tbm_result_insert(table, &node_new, pos, index);
+		if(ret < 0)
+			goto err_result_insert;
+
+		retire = node->result;
+		ret = tbm_publish(table, slot, num, rank, &node_new);
+		if(ret < 0)
+			goto err_result_publish;
+
+		tbm_free(table, retire);
+	}else{
+		child = tbm_child_insert(table, &node_new, bits);
+		if(!child)
+			goto err_child_insert;
+
+		ret = tbm_chain_build(table, child, addr,
+			depth + TBM_STRIDE, prefix_len, index);
+		if(ret < 0)
+			goto err_chain_build;
+
+		retire = node->child;
+		ret = tbm_publish(table, slot, num, rank, &node_new);
+		if(ret < 0)
+			goto err_chain_publish;
+
+		tbm_free(table, retire);
+	}
+
+out:
+	return 0;
+
+err_chain_publish:
+err_chain_build:
+	/* New chain is still private and can be freed at once */
+	_tbm_release(child);
+	ufp_mem_free(node_new.child);
+err_child_insert:
+	return -1;
+
+err_result_publish:
+	ufp_mem_free(node_new.result);
+err_result_insert:
+	return -1;
+}
+
+int tbm_delete(struct tbm_table *table, void *prefix,
+	unsigned int prefix_len)
+{
+	struct tbm_node *path[TBM_MAX_LEVEL];
+	struct tbm_node **path_slot[TBM_MAX_LEVEL];
+	unsigned int path_num[TBM_MAX_LEVEL];
+	unsigned int path_rank[TBM_MAX_LEVEL];
+	unsigned int path_bits[TBM_MAX_LEVEL];
+	void *retire[TBM_MAX_LEVEL + 1];
+	struct tbm_node *node, node_new;
+	unsigned __int128 addr;
+	unsigned int depth, bits, pos;
+	int level, top, num_retire, i, ret;
+
+	addr = tbm_addr(prefix);
+	node = table->root;
+	level = 0;
+	path[0] = node;
+	path_slot[0] = &table->root;
+	path_num[0] = 1;
+	path_rank[0] = 0;
+
+	for(depth = 0; prefix_len - depth >= TBM_STRIDE;
+	depth += TBM_STRIDE){
+		bits = tbm_index(addr, depth);
+		if(!(node->children & (1ULL << bits)))
+			goto err_not_found;
+
+		path_bits[level] = bits;
+		level++;
+
+		path_slot[level] = &node->child;
+		path_num[level] = tbm_popcount(node->children);
+		path_rank[level] = tbm_rank(node->children, bits);
+		node = &node->child[path_rank[level]];
+		path[level] = node;
+	}
+
+	pos = tbm_pos(addr, depth, prefix_len - depth);
+	if(!(node->prefixes & (1ULL << pos)))
+		goto err_not_found;
+
+	/* Find the highest node which remains after removal */
+	top = level;
+	if(level && node->prefixes == (1ULL << pos) && !node->children){
+		top = level - 1;
+		while(top && !path[top]->prefixes
+		&& tbm_popcount(path[top]->children) == 1){
+			top--;
+		}
+	}
+
+	node_new = *path[top];
+	num_retire = 0;
+
+	if(top == level){
+		ret = tbm_result_remove(table, &node_new, pos);
+		if(ret < 0)
+			goto err_result_remove;
+
+		retire[num_retire++] = path[top]->result;
+	}else{
+		ret = tbm_child_remove(table, &node_new, path_bits[top]);
+		if(ret < 0)
+			goto err_child_remove;
+
+		/* Arrays of detached nodes below top */
+		retire[num_retire++] = path[top]->child;
+		for(i = top + 1; i < level; i++){
+			retire[num_retire++] = path[i]->child;
+		}
+		retire[num_retire++] = path[level]->result;
+	}
+
+	ret = tbm_publish(table, path_slot[top], path_num[top],
+		path_rank[top], &node_new);
+	if(ret < 0)
+		goto err_publish;
+
+	for(i = 0; i < num_retire; i++){
+		tbm_free(table, retire[i]);
+	}
+
+	return 0;
+
+err_publish:
+	if(node_new.result && node_new.result != path[top]->result)
+		ufp_mem_free(node_new.result);
+	if(node_new.child && node_new.child != path[top]->child)
+		ufp_mem_free(node_new.child);
+err_result_remove:
+err_child_remove:
+err_not_found:
+	return -1;
+}
+
+uint32_t tbm_find(struct tbm_table *table, void *prefix,
+	unsigned int prefix_len)
+{
+	struct tbm_node *node;
+	unsigned __int128 addr;
+	unsigned int depth, bits, pos;
+
+	addr = tbm_addr(prefix);
+	node = table->root;
+
+	for(depth = 0; prefix_len - depth >= TBM_STRIDE;
+	depth += TBM_STRIDE){
+		bits = tbm_index(addr, depth);
+		if(!(node->children & (1ULL << bits)))
+			goto err_not_found;
+
+		node = &node->child[tbm_rank(node->children, bits)];
+	}
+
+	pos = tbm_pos(addr, depth, prefix_len - depth);
+	if(!(node->prefixes & (1ULL << pos)))
+		goto err_not_found;
+
+	return node->result[tbm_rank(node->prefixes, pos)];
+
+err_not_found:
+	return 0;
+}
+
+void tbm_lookup_bulk(struct tbm_table *table, void **dst,
+	uint32_t *index, int num)
+{
+	struct tbm_node *node[TBM_LOOKUP_BULK];
+	struct tbm_node *match_node[TBM_LOOKUP_BULK];
+	unsigned int match_pos[TBM_LOOKUP_BULK];
+	unsigned __int128 addr[TBM_LOOKUP_BULK];
+	unsigned int depth, bits;
+	uint64_t match;
+	int base, n, i, active;
+
+	for(base = 0; base < num; base += TBM_LOOKUP_BULK){
+		n = min(num - base, TBM_LOOKUP_BULK);
+
+		for(i = 0; i < n; i++){
+			addr[i] = tbm_addr(dst[base + i]);
+			node[i] = table->root;
+			match_node[i] = NULL;
+			match_pos[i] = 0;
+		}
+
+		/*
+		 * Advance every lookup by one stride per round,
+		 * so that the next nodes are prefetched in parallel.
+		 */
+		for(depth = 0, active = n; active; depth += TBM_STRIDE){
+			active = 0;
+
+			for(i = 0; i < n; i++){
+				if(!node[i])
+					continue;
+
+				bits = tbm_index(addr[i], depth);
+
+				match = node[i]->prefixes & table->mask[bits];
+				if(match){
+					match_node[i] = node[i];
+					match_pos[i] = 63 - __builtin_clzll(match);
+				}
+
+				if(!(node[i]->children & (1ULL << bits))){
+					node[i] = NULL;
+					continue;
+				}
+
+				node[i] = &node[i]->child[tbm_rank(
+					node[i]->children, bits)];
+				prefetch(node[i]);
+				active++;
+			}
+		}
+
+		for(i = 0; i < n; i++){
+			if(match_node[i]){
+				prefetch(&match_node[i]->result[tbm_rank(
+					match_node[i]->prefixes, match_pos[i])]);
+			}
+		}
+
+		for(i = 0; i < n; i++){
+			index[base + i] = match_node[i] ?
+				match_node[i]->result[tbm_rank(
+				match_node[i]->prefixes, match_pos[i])] : 0;
+		}
+	}
+
+	return;
+}
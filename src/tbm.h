@@ -0,0 +1,106 @@
+#ifndef _UFPD_TBM_H
+#define _UFPD_TBM_H
+
+#include <stdint.h>
+#include <endian.h>
+#include <ufp.h>
+#include "main.h"
+#include "rcu.h"
+
+#define TBM_STRIDE	6
+#define TBM_NODE_SIZE	(1 << TBM_STRIDE)
+#define TBM_MAX_LEVEL	(128 / TBM_STRIDE + 1)
+#define TBM_LOOKUP_BULK	32
+
+/*
+ * Tree bitmap node:
+ * prefixes	: internal bitmap, prefixes of length 0..5 in this stride.
+ *		  Prefix of length l with bits b is at ((1 << l) - 1 + b).
+ * children	: external bitmap, child exists for each 6bit index.
+ * Children and results are stored contiguously in order of bitmap,
+ * and located by popcount.
+ * Nodes are updated by copy, so lookup runs without any lock.
+ */
+struct tbm_node {
+	uint64_t		prefixes;
+	uint64_t		children;
+	struct tbm_node		*child;
+	uint32_t		*result;
+};
+
+struct tbm_table {
+	struct tbm_node		*root;
+	uint64_t		mask[TBM_NODE_SIZE];
+	struct ufp_mpool	*mpool;
+	struct rcu		*rcu;
+};
+
+#define tbm_popcount(x) \
+	__builtin_popcountll(x)
+#define tbm_rank(bitmap, pos) \
+	tbm_popcount((bitmap) & ((1ULL << (pos)) - 1))
+
+struct tbm_table *tbm_alloc(struct ufp_mpool *mpool, struct rcu *rcu);
+void tbm_release(struct tbm_table *table);
+int tbm_add(struct tbm_table *table, void *prefix,
+	unsigned int prefix_len, uint32_t index);
+int tbm_delete(struct tbm_table *table, void *prefix,
+	unsigned int prefix_len);
+uint32_t tbm_find(struct tbm_table *table, void *prefix,
+	unsigned int prefix_len);
+void tbm_lookup_bulk(struct tbm_table *table, void **dst,
+	uint32_t *index, int num);
+
+static inline unsigned __int128 tbm_addr(void *addr)
+{
+	return ((unsigned __int128)be64toh(((uint64_t *)addr)[0]) << 64)
+		| be64toh(((uint64_t *)addr)[1]);
+}
+
+static inline unsigned int tbm_index(unsigned __int128 addr,
+	unsigned int depth)
+{
+	/* The last stride is padded with zero */
+	return (depth <= 128 - TBM_STRIDE
+		? (uint64_t)(addr >> (128 - TBM_STRIDE - depth))
+		: (uint64_t)(addr << (depth - (128 - TBM_STRIDE))))
+		& (TBM_NODE_SIZE - 1);
+}
+
+static inline uint32_t tbm_lookup(struct tbm_table *table,
+	void *dst)
+{
+	struct tbm_node *node, *match_node;
+	unsigned __int128 addr;
+	unsigned int depth, bits, match_pos;
+	uint64_t match;
+
+	addr = tbm_addr(dst);
+	node = table->root;
+	match_node = NULL;
+	match_pos = 0;
+
+	for(depth = 0; ; depth += TBM_STRIDE){
+		bits = tbm_index(addr, depth);
+
+		/* Highest position is the longest prefix in this node */
+		match = node->prefixes & table->mask[bits];
+		if(match){
+			match_node = node;
+			match_pos = 63 - __builtin_clzll(match);
+		}
+
+		if(!(node->children & (1ULL << bits)))
+			break;
+
+		node = &node->child[tbm_rank(node->children, bits)];
+	}
+
+	/* Result array is touched only once per lookup */
+	if(!match_node)
+		return 0;
+
+	return match_node->result[tbm_rank(match_node->prefixes, match_pos)];
+}
+
+#endif /* _UFPD_TBM_H */
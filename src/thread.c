@@ -9,11 +9,10 @@
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <net/ethernet.h>
+#include <linux/virtio_net.h>
 #include <signal.h>
 #include <sys/signalfd.h>
 #include <pthread.h>
-#include <linux/netlink.h>
-#include <linux/rtnetlink.h>
 #include <stddef.h>
 #include <syslog.h>
 #include <ufp.h>
@@ -22,20 +21,24 @@
 #include "thread.h"
 #include "forward.h"
 #include "epoll.h"
-#include "netlink.h"
+#include "control.h"
 
 static int thread_fd_prepare(struct list_head *ep_desc_head,
 	struct ufpd_thread *thread);
 static void thread_fd_destroy(struct list_head *ep_desc_head,
 	int fd_ep);
 static int thread_wait(struct ufpd_thread *thread, int fd_ep);
+static int thread_poll(struct ufpd_thread *thread, int fd_ep);
+static inline void thread_process_rx_poll(struct ufpd_thread *thread,
+	struct ufp_packet *packet);
 static inline int thread_process_irq_rx(struct ufpd_thread *thread,
 	struct epoll_desc *ep_desc, struct ufp_packet *packet);
 static inline int thread_process_irq_tx(struct ufpd_thread *thread,
 	struct epoll_desc *ep_desc);
+static inline void thread_reap_tx(struct ufpd_thread *thread);
 static inline int thread_process_tun(struct ufpd_thread *thread,
 	struct epoll_desc *ep_desc);
-static inline int thread_process_netlink(struct ufpd_thread *thread,
+static inline int thread_process_control(struct ufpd_thread *thread,
 	struct epoll_desc *ep_desc);
 static inline int thread_process_signal(struct ufpd_thread *thread,
 	struct epoll_desc *ep_desc);
@@ -51,15 +54,19 @@ void *thread_process_interrupt(void *data)
 	ufpd_log(LOG_INFO, "thread %d started", thread->id);
 	thread->read_size = getpagesize();
 	list_init(&ep_desc_head);
-
-	/* Prepare fib */
-	thread->fib_inet = fib_alloc(thread->mpool);
-	if(!thread->fib_inet)
-		goto err_fib_inet_alloc;
-
-	thread->fib_inet6 = fib_alloc(thread->mpool);
-	if(!thread->fib_inet6)
-		goto err_fib_inet6_alloc;
+	thread->count_poll_enter = 0;
+	thread->count_poll_exit = 0;
+
+	/* Prepare fib, shared one is maintained by control thread */
+	if(!thread->rcu_reader){
+		thread->fib_inet = fib_alloc(thread->mpool, AF_INET, NULL);
+		if(!thread->fib_inet)
+			goto err_fib_inet_alloc;
+
+		thread->fib_inet6 = fib_alloc(thread->mpool, AF_INET6, NULL);
+		if(!thread->fib_inet6)
+			goto err_fib_inet6_alloc;
+	}
 
 	/* Prepare Neighbor table */
 	thread->neigh_inet = ufp_mem_alloc(thread->mpool,
@@ -82,8 +89,10 @@ void *thread_process_interrupt(void *data)
 			goto err_neigh_inet6_alloc;
 
 		/* calclulate maximum buf_size we should prepare */
-		if(ufp_framemtu(thread->plane, i) > thread->read_size)
-			thread->read_size = ufp_framemtu(thread->plane, i);
+		if(ufp_framemtu(thread->plane, i)
+		+ sizeof(struct virtio_net_hdr) > thread->read_size)
+			thread->read_size = ufp_framemtu(thread->plane, i)
+				+ sizeof(struct virtio_net_hdr);
 
 		continue;
 
@@ -93,6 +102,29 @@ err_neigh_inet_alloc:
 		goto err_assign_ports;
 	}
 
+	/* Prepare adaptive RX polling state */
+	thread->rx_poll = ufp_mem_alloc(thread->mpool,
+		sizeof(struct thread_rx_poll) * thread->num_ports);
+	if(!thread->rx_poll)
+		goto err_alloc_rx_poll;
+
+	for(i = 0; i < thread->num_ports; i++){
+		thread->rx_poll[i].irq = ufp_irq(thread->plane, i, UFP_IRQ_RX);
+		thread->rx_poll[i].polling = 0;
+		thread->rx_poll[i].idle = 0;
+	}
+	thread->rx_polling = 0;
+
+	/* Prepare TX staging per output port */
+	thread->tx_stage = ufp_mem_alloc(thread->mpool,
+		sizeof(struct forward_stage) * thread->num_ports);
+	if(!thread->tx_stage)
+		goto err_alloc_tx_stage;
+
+	for(i = 0; i < thread->num_ports; i++){
+		thread->tx_stage[i].num = 0;
+	}
+
 	/* Prepare read buffer */
 	thread->read_buf = malloc(thread->read_size);
 	if(!thread->read_buf)
@@ -110,7 +142,10 @@ err_neigh_inet_alloc:
 		ufp_rx_assign(thread->plane, i, thread->buf);
 	}
 
-	ret = thread_wait(thread, fd_ep);
+	if(thread->busy_poll)
+		ret = thread_poll(thread, fd_ep);
+	else
+		ret = thread_wait(thread, fd_ep);
 	if(ret < 0)
 		goto err_wait;
 
@@ -119,6 +154,10 @@ err_wait:
 err_ixgbe_epoll_prepare:
 	free(thread->read_buf);
 err_alloc_read_buf:
+	ufp_mem_free(thread->tx_stage);
+err_alloc_tx_stage:
+	ufp_mem_free(thread->rx_poll);
+err_alloc_rx_poll:
 err_assign_ports:
 	for(i = 0; i < ports_assigned; i++){
 		neigh_release(thread->neigh_inet6[i]);
@@ -128,9 +167,11 @@ err_assign_ports:
 err_neigh_table_inet6:
 	ufp_mem_free(thread->neigh_inet);
 err_neigh_table_inet:
-	fib_release(thread->fib_inet6);
+	if(!thread->rcu_reader)
+		fib_release(thread->fib_inet6);
 err_fib_inet6_alloc:
-	fib_release(thread->fib_inet);
+	if(!thread->rcu_reader)
+		fib_release(thread->fib_inet);
 err_fib_inet_alloc:
 	thread_print_result(thread);
 	pthread_kill(thread->ptid, SIGINT);
@@ -142,7 +183,6 @@ static int thread_fd_prepare(struct list_head *ep_desc_head,
 {
 	struct epoll_desc 	*ep_desc;
 	sigset_t		sigset;
-	struct sockaddr_nl	addr;
 	int			fd_ep, i, ret;
 
 	/* epoll fd preparing */
@@ -153,6 +193,10 @@ static int thread_fd_prepare(struct list_head *ep_desc_head,
 	}
 
 	for(i = 0; i < thread->num_ports; i++){
+		/* Interrupts are never armed in busy-poll mode */
+		if(thread->busy_poll)
+			goto register_tun;
+
 		/* Register RX interrupt fd */
 		ep_desc = epoll_desc_alloc_irq(thread->plane, i, UFP_IRQ_RX);
 		if(!ep_desc)
@@ -166,6 +210,10 @@ static int thread_fd_prepare(struct list_head *ep_desc_head,
 			goto err_assign_port;
 		}
 
+		/* TX is reaped on RX path instead */
+		if(thread->no_tx_irq)
+			goto register_tun;
+
 		/* Register TX interrupt fd */
 		ep_desc = epoll_desc_alloc_irq(thread->plane, i, UFP_IRQ_TX);
 		if(!ep_desc)
@@ -179,6 +227,7 @@ static int thread_fd_prepare(struct list_head *ep_desc_head,
 			goto err_assign_port;
 		}
 
+register_tun:
 		/* Register Virtual Interface fd */
 		ep_desc = epoll_desc_alloc_tun(thread->plane, i);
 		if(!ep_desc)
@@ -208,27 +257,23 @@ static int thread_fd_prepare(struct list_head *ep_desc_head,
 		goto err_epoll_add_signalfd;
 	}
 
-	/* netlink preparing */
-	memset(&addr, 0, sizeof(struct sockaddr_nl));
-	addr.nl_family = AF_NETLINK;
-	addr.nl_groups = RTMGRP_NEIGH | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
-
-	ep_desc = epoll_desc_alloc_netlink(&addr);
+	/* Updates from control thread */
+	ep_desc = epoll_desc_alloc_control(thread->control_ring);
 	if(!ep_desc)
-		goto err_epoll_desc_netlink;
+		goto err_epoll_desc_control;
 
 	list_add_last(ep_desc_head, &ep_desc->list);
 
 	ret = epoll_add(fd_ep, ep_desc, ep_desc->fd);
 	if(ret < 0){
 		perror("failed to add fd in epoll");
-		goto err_epoll_add_netlink;
+		goto err_epoll_add_control;
 	}
 
 	return fd_ep;
 
-err_epoll_add_netlink:
-err_epoll_desc_netlink:
+err_epoll_add_control:
+err_epoll_desc_control:
 err_epoll_add_signalfd:
 err_epoll_desc_signalfd:
 err_assign_port:
@@ -257,6 +302,9 @@ static void thread_fd_destroy(struct list_head *ep_desc_head,
 		case EPOLL_TUN:
 			epoll_desc_release_tun(ep_desc);
 			break;
+		case EPOLL_CONTROL:
+			epoll_desc_release_control(ep_desc);
+			break;
 		default:
 			break;
 		}
@@ -273,11 +321,26 @@ static int thread_wait(struct ufpd_thread *thread, int fd_ep)
 	struct ufp_packet packet[UFPD_RX_BUDGET];
         int i, err, num_fd;
 
+	thread->control_pending = 0;
+
 	while(1){
-		num_fd = epoll_wait(fd_ep, events, EPOLL_MAXEVENTS, -1);
+		/* Shared FIB can be reclaimed while we are sleeping */
+		if(thread->rcu_reader)
+			rcu_offline(thread->rcu_reader);
+
+		/*
+		 * Don't sleep while updates or polled queues are left.
+		 * Without TX IRQ, wake up to reap TX of idle ports.
+		 */
+		num_fd = epoll_wait(fd_ep, events, EPOLL_MAXEVENTS,
+			(thread->control_pending || thread->rx_polling) ? 0 :
+			(thread->no_tx_irq ? THREAD_REAP_TIMEOUT : -1));
 		if(num_fd < 0)
 			goto err_wait;
 
+		if(thread->rcu_reader)
+			rcu_online(thread->rcu_reader);
+
 		for(i = 0; i < num_fd; i++){
 			ep_desc = (struct epoll_desc *)events[i].data.ptr;
 
@@ -298,8 +361,136 @@ static int thread_wait(struct ufpd_thread *thread, int fd_ep)
 				if(err < 0)
 					goto err_process;
 				break;
-			case EPOLL_NETLINK:
-				err = thread_process_netlink(thread, ep_desc);
+			case EPOLL_CONTROL:
+				err = thread_process_control(thread, ep_desc);
+				if(err < 0)
+					goto err_process;
+				break;
+			case EPOLL_SIGNAL:
+				err = thread_process_signal(thread, ep_desc);
+				if(err < 0)
+					goto err_process;
+				goto out;
+				break;
+			default:
+				break;
+			}
+		}
+
+		if(thread->rx_polling)
+			thread_process_rx_poll(thread, packet);
+
+		if(thread->no_tx_irq)
+			thread_reap_tx(thread);
+
+		/* Apply a bounded batch of updates between RX bursts */
+		if(thread->control_pending){
+			thread->control_pending = control_ring_apply(
+				thread->control_ring, thread, CONTROL_BUDGET);
+		}
+	}
+
+out:
+	return 0;
+
+err_process:
+err_wait:
+	return -1;
+}
+
+static inline void thread_process_rx_poll(struct ufpd_thread *thread,
+	struct ufp_packet *packet)
+{
+	struct thread_rx_poll *rx_poll;
+	unsigned int port_index;
+	int ret, i;
+
+	for(port_index = 0; port_index < thread->num_ports; port_index++){
+		rx_poll = &thread->rx_poll[port_index];
+		if(!rx_poll->polling)
+			continue;
+
+		ret = ufp_rx_clean(thread->plane, port_index,
+			thread->buf, packet);
+		if(ret){
+			forward_process(thread, port_index, packet, ret);
+			rx_poll->idle = 0;
+			continue;
+		}
+
+		if(++rx_poll->idle < thread->adapt_idle)
+			continue;
+
+		/* Queue went quiet, back to interrupt */
+		rx_poll->polling = 0;
+		thread->rx_polling--;
+		thread->count_poll_exit++;
+		ufp_irq_unmask_queues(thread->plane, port_index,
+			rx_poll->irq);
+	}
+
+	for(i = 0; i < thread->num_ports; i++){
+		ufp_tx_xmit(thread->plane, i);
+	}
+
+	return;
+}
+
+static int thread_poll(struct ufpd_thread *thread, int fd_ep)
+{
+	struct epoll_desc *ep_desc;
+	struct epoll_event events[EPOLL_MAXEVENTS];
+	struct ufp_packet packet[UFPD_RX_BUDGET];
+	unsigned int iter;
+	int i, ret, err, num_fd;
+
+	thread->control_pending = 0;
+	iter = 0;
+
+	/* Never goes offline, epoch is refreshed between bursts instead */
+	if(thread->rcu_reader)
+		rcu_online(thread->rcu_reader);
+
+	while(1){
+		for(i = 0; i < thread->num_ports; i++){
+			ret = ufp_rx_clean(thread->plane, i,
+				thread->buf, packet);
+			if(ret)
+				forward_process(thread, i, packet, ret);
+		}
+
+		for(i = 0; i < thread->num_ports; i++){
+			ufp_tx_xmit(thread->plane, i);
+			ufp_tx_clean(thread->plane, i, thread->buf);
+		}
+
+		for(i = 0; i < thread->num_ports; i++){
+			ufp_rx_assign(thread->plane, i, thread->buf);
+		}
+
+		/* Slow path fds are checked once in a while */
+		if(likely(++iter & (THREAD_POLL_INTERVAL - 1)))
+			continue;
+
+		/* Report quiescent state, we hold no FIB reference here */
+		if(thread->rcu_reader)
+			rcu_online(thread->rcu_reader);
+
+		num_fd = epoll_wait(fd_ep, events, EPOLL_MAXEVENTS, 0);
+		if(num_fd < 0)
+			goto err_wait;
+
+		for(i = 0; i < num_fd; i++){
+			ep_desc = (struct epoll_desc *)events[i].data.ptr;
+
+			switch(ep_desc->type){
+			case EPOLL_TUN:
+				err = thread_process_tun(thread, ep_desc);
+				if(err < 0)
+					goto err_process;
+				break;
+			case EPOLL_CONTROL:
+				err = thread_process_control(thread, ep_desc);
 				if(err < 0)
 					goto err_process;
 				break;
@@ -313,6 +504,11 @@ static int thread_wait(struct ufpd_thread *thread, int fd_ep)
 				break;
 			}
 		}
+
+		if(thread->control_pending){
+			thread->control_pending = control_ring_apply(
+				thread->control_ring, thread, CONTROL_BUDGET);
+		}
 	}
 
 out:
@@ -327,7 +523,7 @@ static inline int thread_process_irq_rx(struct ufpd_thread *thread,
 	struct epoll_desc *ep_desc, struct ufp_packet *packet)
 {
 	unsigned int port_index;
-	int ret, i;
+	int ret, i, polling;
 
 	port_index = ep_desc->port_index;
 
@@ -341,10 +537,22 @@ static inline int thread_process_irq_rx(struct ufpd_thread *thread,
 		ufp_tx_xmit(thread->plane, i);
 	}
 
+	/* Heavy burst, keep the queue masked and poll it */
+	polling = thread->adapt_threshold
+		&& ret >= thread->adapt_threshold;
+
 	ret = read(ep_desc->fd, thread->read_buf, thread->read_size);
 	if(ret < 0)
 		goto err_read;
 
+	if(polling){
+		thread->rx_poll[port_index].polling = 1;
+		thread->rx_poll[port_index].idle = 0;
+		thread->rx_polling++;
+		thread->count_poll_enter++;
+		return 0;
+	}
+
 	ufp_irq_unmask_queues(thread->plane, port_index,
 		(struct ufp_irq *)ep_desc->data);
 	return 0;
@@ -363,6 +571,8 @@ static inline int thread_process_irq_tx(struct ufpd_thread *thread,
 
 	/* Tx descripter cleaning */
 	ufp_tx_clean(thread->plane, port_index, thread->buf);
+
+	/* RX rings are refilled on RX, except the ones starved of slots */
 	for(i = 0; i < thread->num_ports; i++){
 		ufp_rx_assign(thread->plane, i, thread->buf);
 	}
@@ -379,6 +589,22 @@ err_read:
 	return -1;
 }
 
+static inline void thread_reap_tx(struct ufpd_thread *thread)
+{
+	int i;
+
+	for(i = 0; i < thread->num_ports; i++){
+		ufp_tx_clean(thread->plane, i, thread->buf);
+	}
+
+	/* Rings starved of slots, as TX IRQ does */
+	for(i = 0; i < thread->num_ports; i++){
+		ufp_rx_assign(thread->plane, i, thread->buf);
+	}
+
+	return;
+}
+
 static inline int thread_process_tun(struct ufpd_thread *thread,
 	struct epoll_desc *ep_desc)
 {
@@ -401,16 +627,17 @@ err_read:
 	return -1;
 }
 
-static inline int thread_process_netlink(struct ufpd_thread *thread,
+static inline int thread_process_control(struct ufpd_thread *thread,
 	struct epoll_desc *ep_desc)
 {
 	int ret;
 
+	/* Ring is drained after eventfd, so no kick is lost */
 	ret = read(ep_desc->fd, thread->read_buf, thread->read_size);
 	if(ret < 0)
 		goto err_read;
 
-	netlink_process(thread, thread->read_buf, ret);
+	thread->control_pending = 1;
 	return 0;
 
 err_read:
@@ -433,6 +660,7 @@ err_read:
 
 static void thread_print_result(struct ufpd_thread *thread)
 {
+	struct ufp_mem_stats stats;
 	int i;
 
 	for(i = 0; i < thread->num_ports; i++){
@@ -446,5 +674,13 @@ static void thread_print_result(struct ufpd_thread *thread)
 		ufpd_log(LOG_INFO, "  Tx packetes transmitted = %lu",
 			ufp_count_tx_clean_total(thread->plane, i));
 	}
+	ufpd_log(LOG_INFO, "thread %d switched to polling %lu times,"
+		" back to interrupt %lu times", thread->id,
+		thread->count_poll_enter, thread->count_poll_exit);
+
+	ufp_mem_stats(thread->mpool, &stats);
+	ufpd_log(LOG_INFO, "thread %d memory free = %lu/%lu bytes,"
+		" fragmentation = %u%%", thread->id,
+		stats.free, stats.size, stats.fragmentation);
 	return;
 }
@@ -6,6 +6,19 @@
 
 #include "neigh.h"
 #include "fib.h"
+#include "control.h"
+
+#define THREAD_POLL_INTERVAL 64 /* must be power of 2 */
+#define THREAD_REAP_TIMEOUT 1 /* ms, without TX IRQ */
+
+/* RX queue switched from interrupt to polling under load */
+struct thread_rx_poll {
+	struct ufp_irq		*irq;
+	unsigned int		polling;
+	unsigned int		idle;
+};
+
+struct forward_stage;
 
 struct ufpd_thread {
 	struct ufp_plane	*plane;
@@ -21,6 +34,18 @@ struct ufpd_thread {
 	unsigned int		num_ports;
 	uint8_t			*read_buf;
 	size_t			read_size;
+	struct rcu_reader	*rcu_reader; /* NULL when FIB is private */
+	struct control_ring	*control_ring;
+	int			control_pending;
+	int			busy_poll;
+	int			no_tx_irq;
+	struct forward_stage	*tx_stage; /* per output port */
+	struct thread_rx_poll	*rx_poll;
+	unsigned int		rx_polling; /* number of polled ports */
+	unsigned int		adapt_threshold; /* 0 disables */
+	unsigned int		adapt_idle;
+	unsigned long		count_poll_enter;
+	unsigned long		count_poll_exit;
 };
 
 void *thread_process_interrupt(void *data);